@@ -0,0 +1,170 @@
+/* ---------------------------------------------------------------------------
+** sqlite3-bind: SQLite C API - Parameter binding helper for SQLite.
+** ---------------------------------------------------------------------------
+** Copyright (c) 2016 by Payton Bissell, payton.bissell@gmail.com
+** ---------------------------------------------------------------------------
+** This example demonstrats using the sqlite3-bind parallel scan to split an
+** aggregate query over several read connections. It builds a synthetic
+** re_trans table of several million rows in "parallel.db" (WAL mode), then
+** times the same price range aggregate with 1, 2, 4 and 8 connections, and
+** checks that the ordered concatenation returns the rows of a plain query.
+**
+** usage: ex_parallel [rows]      (default 4000000)
+**
+** 1. It does not imply or even demonstrate good programming practices.
+** 2. Timings depend on the number of cores and the disk cache, run it twice.
+**    The scaling over 1 to 8 connections has not been measured yet, it was
+**    only run on a single core machine, where the times don't improve.
+** 3. It is not defect free, so use with caution.
+**
+** ---------------------------------------------------------------------------
+*/
+
+// clock_gettime and CLOCK_MONOTONIC are POSIX, strict ISO builds (-std=c99) hide them otherwise.
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sqlite3-bind.h>
+
+static const char *tbl = "drop table if exists re_trans;"
+"create table re_trans"
+"( re_trans_id integer primary key,"
+"  city        text not null default '',"
+"  beds        integer not null default 0,"
+"  sqft        integer not null default 0,"
+"  price       integer not null default 0"
+");";
+
+static const char *cities[] = { "SACRAMENTO", "ELK GROVE", "ROSEVILLE", "FOLSOM", "CITRUS HEIGHTS", "RANCHO CORDOVA" };
+
+/* ---------------------------------------------------------------------------
+** Producer for sqlite3_bind_array_pull, makes up the synthetic rows.
+*/
+typedef struct gen { int next, rows; unsigned int seed; } gen;
+
+static int fill_rows(void *arg, int capacity, sqlite3_bind_column *cols, int ncols)
+{ gen *g = (gen*)arg;
+  int n=0;
+  while ((n<capacity)&&(g->next<g->rows))
+  { g->seed = g->seed*1103515245u + 12345u;
+    ((const char**)cols[0].data)[n] = cities[(g->seed>>16)%6];
+    ((int*)cols[1].data)[n] = 1 + (g->seed>>8)%5;
+    ((int*)cols[2].data)[n] = 600 + (g->seed>>4)%3000;
+    ((int*)cols[3].data)[n] = 20000 + (g->seed>>3)%900000;
+    g->next++;
+    n++;
+  }
+  return n;
+}
+
+/* ---------------------------------------------------------------------------
+** Combine the partial aggregates of each part: count, sum, min, max.
+*/
+typedef struct agg { sqlite3_int64 cnt, sum, min, max; } agg;
+
+static int combine(void *arg, int argc, sqlite3_value **argv)
+{ agg *a = (agg*)arg;
+  if (argc!=4) return 1;
+  if (sqlite3_value_int64(argv[0])==0) return 0; // empty part, min/max are null
+  a->cnt += sqlite3_value_int64(argv[0]);
+  a->sum += sqlite3_value_int64(argv[1]);
+  if ((a->min<0)||(sqlite3_value_int64(argv[2])<a->min)) a->min=sqlite3_value_int64(argv[2]);
+  if (sqlite3_value_int64(argv[3])>a->max) a->max=sqlite3_value_int64(argv[3]);
+  return 0;
+}
+
+/* ---------------------------------------------------------------------------
+** Count the concatenated rows, and check they arrive in key order.
+*/
+typedef struct seq { sqlite3_int64 rows, last; int sorted; } seq;
+
+static int concat(void *arg, int argc, sqlite3_value **argv)
+{ seq *s = (seq*)arg;
+  if (sqlite3_value_int64(argv[0])<=s->last) s->sorted=0;
+  s->last=sqlite3_value_int64(argv[0]);
+  s->rows++;
+  return 0;
+}
+
+static int get_int64(void *arg, int argc, char **argv, char **cols)
+{ ((sqlite3_int64*)arg)[0]=atoll(argv[0]);
+  ((sqlite3_int64*)arg)[1]=atoll(argv[1]);
+  return 0;
+}
+
+static double now_sec(void)
+{ struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/* ---------------------------------------------------------------------------
+** Build the table and run the scans.
+*/
+int main(int argc, char **argv)
+{ int rows = (argc>1) ? atoi(argv[1]) : 4000000;
+  int lo_price=100000, hi_price=500000, i;
+  sqlite3_int64 range[2];
+  double t0;
+
+  sqlite3 *db=NULL;
+  if (sqlite3_open("parallel.db", &db)!=SQLITE_OK) return 0;
+  sqlite3_exec(db, "pragma journal_mode=wal", NULL, NULL, NULL);
+  if (sqlite3_exec(db, tbl, NULL, NULL, NULL)!=SQLITE_OK) return 0;
+
+  // load the synthetic rows in one transaction, 1024 at a time.
+  gen g = { 0, rows, 42 };
+  t0 = now_sec();
+  sqlite3_exec(db, "begin", NULL, NULL, NULL);
+  int r = sqlite3_bind_array_pull(db, "insert into re_trans (city,beds,sqft,price) values (?,?,?,?)",
+      1024, fill_rows, &g,
+      SQLITE_BIND_COLUMN_TEXT,
+      SQLITE_BIND_COLUMN_INT,
+      SQLITE_BIND_COLUMN_INT,
+      SQLITE_BIND_COLUMN_INT,
+      SQLITE_BIND_END);
+  sqlite3_exec(db, "commit", NULL, NULL, NULL);
+  if (r!=SQLITE_OK)
+  { printf("Load Error: code=%d message=%s\n", r, sqlite3_bind_errmsg(db));
+    sqlite3_close(db);
+    return 0;
+  }
+  printf("Loaded %d rows in %.2fs\n", rows, now_sec()-t0);
+
+  // the key range to split.
+  sqlite3_bind_exec(db, "select min(re_trans_id), max(re_trans_id) from re_trans", get_int64, range, SQLITE_BIND_END);
+
+  // the same aggregate on 1, 2, 4 and 8 connections.
+  const char *agg_sql = "select count(*), sum(price), min(price), max(price) from re_trans"
+                        " where re_trans_id between ?1 and ?2 and price between ? and ?";
+  for (i=1;i<=8;i*=2)
+  { agg a = { 0, 0, -1, 0 };
+    t0 = now_sec();
+    r = sqlite3_bind_parallel(db, agg_sql, i, range[0], range[1], SQLITE_BIND_PARALLEL_COMBINE, combine, &a,
+        SQLITE_BIND_INT(lo_price), SQLITE_BIND_INT(hi_price), SQLITE_BIND_END);
+    if (r!=SQLITE_OK)
+    { printf("Scan Error: code=%d message=%s\n", r, sqlite3_bind_errmsg(db));
+      break;
+    }
+    printf("%d connection(s): %.3fs  count=%lld avg=%lld min=%lld max=%lld\n", i, now_sec()-t0,
+        a.cnt, (a.cnt ? a.sum/a.cnt : 0), a.min, a.max);
+  }
+
+  // ordered concatenation must match a plain query.
+  seq s = { 0, -1, 1 };
+  sqlite3_int64 expect[2] = { 0, 0 };
+  r = sqlite3_bind_parallel(db, "select re_trans_id from re_trans where re_trans_id between ?1 and ?2 and price<?",
+      4, range[0], range[1], SQLITE_BIND_PARALLEL_ORDERED, concat, &s, SQLITE_BIND_INT(lo_price), SQLITE_BIND_END);
+  sqlite3_bind_exec(db, "select count(*), 0 from re_trans where price<?", get_int64, expect, SQLITE_BIND_INT(lo_price), SQLITE_BIND_END);
+  printf("Ordered: code=%d rows=%lld expected=%lld %s\n", r, s.rows, expect[0], s.sorted ? "in order" : "OUT OF ORDER");
+
+  sqlite3_close(db);
+  return 0;
+}
+
+/* EOF */
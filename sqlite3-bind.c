@@ -27,10 +27,21 @@
 ** ---------------------------------------------------------------------------
 */
 
+// clock_gettime and CLOCK_REALTIME are POSIX, strict ISO builds (-std=c99) hide them otherwise.
+#if !defined(I_SQLITE_BIND_OMIT_THREADS) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "sqlite3.h"
 #include "sqlite3-bind.h"
 #include <string.h>
 
+#ifndef I_SQLITE_BIND_OMIT_THREADS
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#endif
+
 /* ---------------------------------------------------------------------------
 ** For now the array binding does not support results. It would require a 
 ** modified callback to pass the bound params for the user to know which
@@ -55,10 +66,144 @@ const char *sqlite3_bind_errmsg(sqlite3 *db)
     case SQLITE_ERR_BIND_STACK_GUIDE_INVALID     : return "sqlite3-bind: guide marker was not recognized.";
     case SQLITE_ERR_BIND_RESULT_COLUMNS_COUNT    : return "the number of result columns does not match setup.";
     case SQLITE_ERR_BIND_ARRAY_CANT_HAVE_RESULTS : return "for now the bind_array functions cannot return results.";
+    case SQLITE_ERR_BIND_CANCELLED               : return "sqlite3-bind: execution was cancelled.";
+    case SQLITE_ERR_BIND_DEADLINE                : return "sqlite3-bind: execution passed its deadline.";
   }
   return sqlite3_errmsg(db);
 }
 
+/* ***************************************************************************
+**      CANCELLATION SECTION
+** ***************************************************************************
+*/
+
+/* ---------------------------------------------------------------------------
+** Number of virtual machine instructions between deadline/cancel checks
+** while a statement is stepping.
+*/
+#define I_SQLITE_BIND_PROGRESS_OPS 1000
+
+struct sqlite3_bind_token
+{ sqlite3_mutex *mx;            // guards everything below, a cancel can come from any thread
+  sqlite3 *db;                  // the connection running under the token, NULL when idle
+  int cancelled;                // sqlite3_bind_token_cancel was called
+  sqlite3_int64 deadline;       // in vfs time (julian day ms), 0 for none
+  sqlite3_int64 rows;           // progress of the last run
+};
+
+/* ---------------------------------------------------------------------------
+** Current time from the default vfs, so no platform clock is needed.
+*/
+static sqlite3_int64 i_now_ms(void)
+{ sqlite3_vfs *vfs = sqlite3_vfs_find(NULL);
+  sqlite3_int64 now=0;
+  double dnow=0.0;
+  if (vfs==NULL) return 0;
+  if ((vfs->iVersion>=2)&&(vfs->xCurrentTimeInt64)) { vfs->xCurrentTimeInt64(vfs, &now); return now; }
+  vfs->xCurrentTime(vfs, &dnow);
+  return (sqlite3_int64)(dnow*86400000.0);
+}
+
+/* ---------------------------------------------------------------------------
+** Public token functions.
+** ---------------------------------------------------------------------------
+*/
+int sqlite3_bind_token_create(sqlite3_bind_token **token, int timeout_ms)
+{ if (token==NULL) return SQLITE_MISUSE;
+  *token = (sqlite3_bind_token*)sqlite3_malloc(sizeof(sqlite3_bind_token));
+  if (*token==NULL) return SQLITE_NOMEM;
+  memset(*token, 0, sizeof(sqlite3_bind_token));
+  (*token)->mx = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+  if (timeout_ms>0) (*token)->deadline = i_now_ms() + timeout_ms;
+  return SQLITE_OK;
+}
+/* --------------------------------------------------------------------------- */
+void sqlite3_bind_token_cancel(sqlite3_bind_token *token)
+{ if (token==NULL) return;
+  sqlite3_mutex_enter(token->mx);
+  token->cancelled=1;
+  // the db can't be closed while it is attached, so the interrupt is safe here.
+  if (token->db) sqlite3_interrupt(token->db);
+  sqlite3_mutex_leave(token->mx);
+}
+/* --------------------------------------------------------------------------- */
+sqlite3_int64 sqlite3_bind_token_rows(sqlite3_bind_token *token)
+{ sqlite3_int64 rows=0;
+  if (token==NULL) return 0;
+  sqlite3_mutex_enter(token->mx);
+  rows=token->rows;
+  sqlite3_mutex_leave(token->mx);
+  return rows;
+}
+/* --------------------------------------------------------------------------- */
+void sqlite3_bind_token_free(sqlite3_bind_token *token)
+{ if (token==NULL) return;
+  sqlite3_mutex_free(token->mx);
+  sqlite3_free(token);
+}
+
+/* ---------------------------------------------------------------------------
+** Check the token, returns SQLITE_OK or the reason to stop.
+*/
+static int i_token_check(sqlite3_bind_token *token)
+{ int ret=SQLITE_OK;
+  if (token==NULL) return SQLITE_OK;
+  sqlite3_mutex_enter(token->mx);
+  if (token->cancelled) ret=SQLITE_ERR_BIND_CANCELLED;
+  else if ((token->deadline!=0)&&(i_now_ms()>=token->deadline)) ret=SQLITE_ERR_BIND_DEADLINE;
+  sqlite3_mutex_leave(token->mx);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------
+** Progress handler, a non-zero return interrupts the running statement.
+*/
+static int i_token_progress(void *arg)
+{ return (i_token_check((sqlite3_bind_token*)arg)!=SQLITE_OK);
+}
+
+/* ---------------------------------------------------------------------------
+** Count a row of progress.
+*/
+static void i_token_row(sqlite3_bind_token *token)
+{ if (token==NULL) return;
+  sqlite3_mutex_enter(token->mx);
+  token->rows++;
+  sqlite3_mutex_leave(token->mx);
+}
+
+/* ---------------------------------------------------------------------------
+** Attach the token to the db for a run. This replaces any progress handler
+** already set on the db.
+*/
+static int i_token_attach(sqlite3_bind_token *token, sqlite3 *db)
+{ if (token==NULL) return SQLITE_OK;
+  sqlite3_mutex_enter(token->mx);
+  token->db=db;
+  token->rows=0;
+  sqlite3_mutex_leave(token->mx);
+  sqlite3_progress_handler(db, I_SQLITE_BIND_PROGRESS_OPS, i_token_progress, token);
+  return i_token_check(token);
+}
+
+/* ---------------------------------------------------------------------------
+** Detach the token after a run. A run interrupted by the token is reported
+** with the reason it was stopped, any other failure keeps its own code.
+*/
+static int i_token_detach(sqlite3_bind_token *token, int ret)
+{ if ((token==NULL)||(token->db==NULL)) return ret;
+  sqlite3_progress_handler(token->db, 0, NULL, NULL);
+  sqlite3_mutex_enter(token->mx);
+  token->db=NULL;
+  sqlite3_mutex_leave(token->mx);
+  if (ret==SQLITE_INTERRUPT) 
+  { int reason = i_token_check(token);
+    if (reason!=SQLITE_OK) ret=reason;
+  }
+  if ((ret==SQLITE_ERR_BIND_CANCELLED)||(ret==SQLITE_ERR_BIND_DEADLINE)) g_last_err_code=ret;
+  return ret;
+}
+
 /* ***************************************************************************
 **      SIMPLE BIND SECTION
 ** ***************************************************************************
@@ -67,7 +212,8 @@ const char *sqlite3_bind_errmsg(sqlite3 *db)
 /* ---------------------------------------------------------------------------
 ** Prototypes for internal functions, not intended for external calls
 */
-static int i_bind_exec_va  (int sqltype, sqlite3 *db, const void *sql, int (*callback)(void*,int,char**,char**), void *arg, va_list params);
+static int i_bind_exec_va  (int sqltype, sqlite3 *db, const void *sql, int (*callback)(void*,int,char**,char**), void *arg, sqlite3_bind_token *token, va_list params);
+static int i_bind_params   (sqlite3_stmt *stmt, int pcnt, va_list *params);
 
 /* ---------------------------------------------------------------------------
 ** Public bind_exec functions stage execution of i_bind_exec_va
@@ -76,7 +222,7 @@ static int i_bind_exec_va  (int sqltype, sqlite3 *db, const void *sql, int (*cal
 int sqlite3_bind_exec(sqlite3 *db, const char *sql, int (*callback)(void*,int,char**,char**), void *arg, ...)
 { va_list params;
   va_start(params, arg);
-  int ret = i_bind_exec_va(1, db, (const void*)sql, callback, arg, params);
+  int ret = i_bind_exec_va(1, db, (const void*)sql, callback, arg, NULL, params);
   va_end(params);
   return ret;
 }
@@ -84,45 +230,156 @@ int sqlite3_bind_exec(sqlite3 *db, const char *sql, int (*callback)(void*,int,ch
 int sqlite3_bind_exec16(sqlite3 *db, const void *sql, int (*callback)(void*,int,char**,char**), void *arg, ...)
 { va_list params;
   va_start(params, arg);
-  int ret = i_bind_exec_va(2, db, sql, callback, arg, params);
+  int ret = i_bind_exec_va(2, db, sql, callback, arg, NULL, params);
   va_end(params);
   return ret;
 }
 /* --------------------------------------------------------------------------- */
 int sqlite3_bind_exec_va(sqlite3 *db, const char *sql, int (*callback)(void*,int,char**,char**), void *arg, va_list params)
-{ return i_bind_exec_va(1, db, (const void*)sql, callback, arg, params);
+{ return i_bind_exec_va(1, db, (const void*)sql, callback, arg, NULL, params);
 }
 /* --------------------------------------------------------------------------- */
 int sqlite3_bind_exec_va16(sqlite3 *db, const void *sql, int (*callback)(void*,int,char**,char**), void *arg, va_list params)
-{ return i_bind_exec_va(2, db, sql, callback, arg, params);
+{ return i_bind_exec_va(2, db, sql, callback, arg, NULL, params);
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_exec_token(sqlite3 *db, const char *sql, int (*callback)(void*,int,char**,char**), void *arg, sqlite3_bind_token *token, ...)
+{ va_list params;
+  va_start(params, token);
+  int ret = i_bind_exec_va(1, db, (const void*)sql, callback, arg, token, params);
+  va_end(params);
+  return ret;
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_exec_token16(sqlite3 *db, const void *sql, int (*callback)(void*,int,char**,char**), void *arg, sqlite3_bind_token *token, ...)
+{ va_list params;
+  va_start(params, token);
+  int ret = i_bind_exec_va(2, db, sql, callback, arg, token, params);
+  va_end(params);
+  return ret;
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_exec_token_va(sqlite3 *db, const char *sql, int (*callback)(void*,int,char**,char**), void *arg, sqlite3_bind_token *token, va_list params)
+{ return i_bind_exec_va(1, db, (const void*)sql, callback, arg, token, params);
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_exec_token_va16(sqlite3 *db, const void *sql, int (*callback)(void*,int,char**,char**), void *arg, sqlite3_bind_token *token, va_list params)
+{ return i_bind_exec_va(2, db, sql, callback, arg, token, params);
 }
 
 /* ---------------------------------------------------------------------------
 ** Check if the sql is completed, or more commands are left to be executed.
-** Can check either sql format. 
+** Can check either sql format. Trailing white space is not worth processing.
 ** ---------------------------------------------------------------------------
 */
+static int i_is_space(unsigned int c)
+{ return ((c==' ')||(c=='\t')||(c=='\n')||(c=='\r')||(c=='\f')||(c=='\v'));
+}
+/* --------------------------------------------------------------------------- */
 static int i_check_tail(int sqltype, const char *p1_tail, const void *p2_tail)
 { if (sqltype==1)
   { if (p1_tail==NULL) return 0;
-    if (strlen(p1_tail)==0) return 0;
+    while (i_is_space((unsigned char)*p1_tail)) p1_tail++;
+    if (*p1_tail==0) return 0;
   }
   if (sqltype==2)
-  { if (p2_tail==NULL) return 0;
-    // TODO: verify that p2_tail contains something worth processing
+  { const unsigned short *p2=(const unsigned short*)p2_tail;
+    if (p2==NULL) return 0;
+    while (i_is_space(*p2)) p2++;
+    if (*p2==0) return 0;
   }
   return 1; 
 }
 
+/* ---------------------------------------------------------------------------
+** Bind pcnt parameters from the stack to the statement. The va_list is passed
+** by pointer so the caller continues from where the binding stopped.
+** ---------------------------------------------------------------------------
+*/
+static int i_bind_params(sqlite3_stmt *stmt, int pcnt, va_list *params)
+{ int i, ret=SQLITE_OK;
+  for (i=0;((ret==SQLITE_OK)&&(i<pcnt));i++)
+  { 
+    // all valid stack params will have a guide marker to denote type, we wont use a stack var without it.
+    unsigned int guide = va_arg(*params, unsigned int);
+    
+    int ni;   // native int
+    char *str; 
+    sqlite3_uint64 i8;
+    void *vp;
+    double dbl;
+    
+    switch(guide)
+    { 
+      case I_SQLITE_BIND_TYPE_BLOB : 
+        ni = va_arg(*params, int); 
+        vp = va_arg(*params, void*); 
+        ret = sqlite3_bind_blob(stmt, i+1, vp, ni, SQLITE_STATIC); 
+        break; 
+        
+      case I_SQLITE_BIND_TYPE_DOUBLE : 
+        dbl = va_arg(*params, double); 
+        ret = sqlite3_bind_double(stmt, i+1, dbl); 
+        break;
+        
+      case I_SQLITE_BIND_TYPE_INT : 
+        ni = va_arg(*params, int); 
+        ret = sqlite3_bind_int(stmt, i+1, ni); 
+        break;
+        
+      case I_SQLITE_BIND_TYPE_INT64 : 
+        i8 = va_arg(*params, sqlite3_uint64); 
+        ret = sqlite3_bind_int64(stmt, i+1, i8); 
+        break;
+        
+      case I_SQLITE_BIND_TYPE_NULL : 
+        ret = sqlite3_bind_null(stmt, i+1); 
+        break;
+
+      case I_SQLITE_BIND_TYPE_TEXT : 
+        str = va_arg(*params, char*); 
+        ret = sqlite3_bind_text(stmt, i+1, str, -1, SQLITE_STATIC); 
+        break;
+        
+      case I_SQLITE_BIND_TYPE_TEXT16 : 
+        vp = va_arg(*params, void*); 
+        ret = sqlite3_bind_text16(stmt, i+1, vp, -1, SQLITE_STATIC); 
+        break;
+        
+      case I_SQLITE_BIND_TYPE_ZBLOB : 
+        ni = va_arg(*params, int); // size
+        ret = sqlite3_bind_zeroblob(stmt, i+1, ni); 
+        break;
+        
+      // this situation means that the stack had less params than there were param-markers in the sql. 
+      // or make my own SQLITE error codes. 
+      case SQLITE_BIND_END :    
+        ret=g_last_err_code=SQLITE_ERR_BIND_STACK_MISSING_PARAMS;
+        break;
+
+      // here means that we don't recognize the guide bytes on the stack.
+      default : ret=g_last_err_code=SQLITE_ERR_BIND_STACK_GUIDE_INVALID;
+    }
+  }
+  return ret;
+}
+
 /* ---------------------------------------------------------------------------
 ** Bind Exec implementation. 
 ** ---------------------------------------------------------------------------
 */
-static int i_bind_exec_va(int sqltype, sqlite3 *db, const void *sql, int (*callback)(void*,int,char**,char**), void *arg, va_list params)
+static int i_bind_exec_va(int sqltype, sqlite3 *db, const void *sql, int (*callback)(void*,int,char**,char**), void *arg, sqlite3_bind_token *token, va_list params)
 { g_last_err_code=SQLITE_OK;
   int i, ret=SQLITE_OK;
   sqlite3_stmt *stmt = NULL;
   
+  // a copy of the stack that can be handed to i_bind_params and continued here.
+  va_list ap;
+  va_copy(ap, params);
+  
+  // a token bounds the whole run, over all the statements.
+  ret = i_token_attach(token, db);
+  
   // only one is used based on the type of null terminated sql is passed: 1=8bit and 2=16bit.
   const char *p1_tail=(sqltype==1)?(const char*)sql:NULL;
   const void *p2_tail=(sqltype==2)?sql:NULL;
@@ -131,85 +388,26 @@ static int i_bind_exec_va(int sqltype, sqlite3 *db, const void *sql, int (*callb
   while ((ret==SQLITE_OK) && (i_check_tail(sqltype, p1_tail, p2_tail)))
   { int argc=0, pcnt=0;
   
+    // the token is checked between statements, an interrupt is lost while no statement is running.
+    if ((ret=i_token_check(token))!=SQLITE_OK) break;
+
     // prep this statment (of potentially many)...
     if (sqltype==1) // const char *
-    { if ( (ret=sqlite3_prepare_v2(db, p1_tail, -1, &stmt, &p1_tail)) != SQLITE_OK) return ret;  
+    { if ( (ret=sqlite3_prepare_v2(db, p1_tail, -1, &stmt, &p1_tail)) != SQLITE_OK) break;  
     }
     else // const void *
-    { if ( (ret=sqlite3_prepare16_v2(db, p2_tail, -1, &stmt, &p2_tail)) != SQLITE_OK) return ret;  
+    { if ( (ret=sqlite3_prepare16_v2(db, p2_tail, -1, &stmt, &p2_tail)) != SQLITE_OK) break;  
     }
 
-    // impossible? prepare should return code above.
-    if (stmt==NULL) return SQLITE_ERROR; 
+    // nothing but a comment was left in the sql.
+    if (stmt==NULL) continue;
 
     // we have a good statement object, so get param count and column count...
     argc = sqlite3_column_count(stmt);
     pcnt = sqlite3_bind_parameter_count(stmt);
     
     // bind all the parameters from the stack...
-    for (i=0;((ret==SQLITE_OK)&&(i<pcnt));i++)
-    { 
-      // all valid stack params will have a guide marker to denote type, we wont use a stack var without it.
-      unsigned int guide = va_arg(params, unsigned int);
-      
-      int ni;   // native int
-      char *str; 
-      sqlite3_uint64 i8;
-      void *vp;
-      double dbl;
-      
-      switch(guide)
-      { 
-        case I_SQLITE_BIND_TYPE_BLOB : 
-          ni = va_arg(params, int); 
-          vp = va_arg(params, void*); 
-          ret = sqlite3_bind_blob(stmt, i+1, vp, ni, SQLITE_STATIC); 
-          break; 
-          
-        case I_SQLITE_BIND_TYPE_DOUBLE : 
-          dbl = va_arg(params, double); 
-          ret = sqlite3_bind_double(stmt, i+1, dbl); 
-          break;
-          
-        case I_SQLITE_BIND_TYPE_INT : 
-          ni = va_arg(params, int); 
-          ret = sqlite3_bind_int(stmt, i+1, ni); 
-          break;
-          
-        case I_SQLITE_BIND_TYPE_INT64 : 
-          i8 = va_arg(params, sqlite3_uint64); 
-          ret = sqlite3_bind_int64(stmt, i+1, i8); 
-          break;
-          
-        case I_SQLITE_BIND_TYPE_NULL : 
-          ret = sqlite3_bind_null(stmt, i+1); 
-          break;
-
-        case I_SQLITE_BIND_TYPE_TEXT : 
-          str = va_arg(params, char*); 
-          ret = sqlite3_bind_text(stmt, i+1, str, -1, SQLITE_STATIC); 
-          break;
-          
-        case I_SQLITE_BIND_TYPE_TEXT16 : 
-          vp = va_arg(params, void*); 
-          ret = sqlite3_bind_text16(stmt, i+1, vp, -1, SQLITE_STATIC); 
-          break;
-          
-        case I_SQLITE_BIND_TYPE_ZBLOB : 
-          ni = va_arg(params, int); // size
-          ret = sqlite3_bind_zeroblob(stmt, i+1, ni); 
-          break;
-          
-        // this situation means that the stack had less params than there were param-markers in the sql. 
-        // or make my own SQLITE error codes. 
-        case SQLITE_BIND_END :    
-          ret=g_last_err_code=SQLITE_ERR_BIND_STACK_MISSING_PARAMS;
-          break;
-
-        // here means that we don't recognize the guide bytes on the stack.
-        default : ret=g_last_err_code=SQLITE_ERR_BIND_STACK_GUIDE_INVALID;
-      }
-    }
+    ret = i_bind_params(stmt, pcnt, &ap);
     
     int row=0;
     char **cols=NULL, **argv=NULL;
@@ -230,6 +428,8 @@ static int i_bind_exec_va(int sqltype, sqlite3 *db, const void *sql, int (*callb
       }
 
       // at this point there must be a SQLITE_ROW of data to process...
+      i_token_row(token);
+      if ((ret=i_token_check(token))!=SQLITE_OK) break;
       
       // there is no need to mess with the data if the callback is not set, just call _step until DONE
       if (callback==NULL) continue; 
@@ -273,16 +473,20 @@ static int i_bind_exec_va(int sqltype, sqlite3 *db, const void *sql, int (*callb
     if (row!=0) for (i=0;i<argc;i++) { sqlite3_free(cols[i]); sqlite3_free(argv[i]); }
     if (cols) sqlite3_free(cols);
     if (argv) sqlite3_free(argv);
-    ret = sqlite3_finalize(stmt); 
+    
+    // keep the code that ended the row loop, the finalize would report SQLITE_OK for a token stop.
+    int fr = sqlite3_finalize(stmt); 
+    if (ret==SQLITE_OK) ret=fr;
   }
 
 // if there are extra parameters pushed on the stack there is no harm, but it is probably 
 // a bug. This can be undefined to tolerate extra stack variables or an unterminated stack
 #ifndef I_SQLITE_BIND_STACK_NOT_CHECKED  
-  if (ret==SQLITE_OK) if (va_arg(params, unsigned int) != SQLITE_BIND_END) ret=g_last_err_code=SQLITE_ERR_BIND_STACK_NOT_TERMINATED;
+  if (ret==SQLITE_OK) if (va_arg(ap, unsigned int) != SQLITE_BIND_END) ret=g_last_err_code=SQLITE_ERR_BIND_STACK_NOT_TERMINATED;
 #endif  
 
-  return ret;
+  va_end(ap);
+  return i_token_detach(token, ret);
 }
 
 /* ***************************************************************************
@@ -290,7 +494,8 @@ static int i_bind_exec_va(int sqltype, sqlite3 *db, const void *sql, int (*callb
 ** ***************************************************************************
 */
 
-static int i_bind_array_va (int sqltype, sqlite3 *db, const void *sql, int rows, va_list params);
+static int i_bind_array_va (int sqltype, sqlite3 *db, const void *sql, int rows, sqlite3_bind_token *token, va_list params);
+static int i_bind_array_row(sqlite3_stmt *stmt, int pcnt, unsigned int *p_types, sqlite_int64 *p_fsizes, int **p_sizes_a, void ***p_pntrs_a, int irow);
 
 /* ---------------------------------------------------------------------------
 ** Public bind_insert functions stage execution of i_bind_insert_va
@@ -299,7 +504,7 @@ static int i_bind_array_va (int sqltype, sqlite3 *db, const void *sql, int rows,
 int sqlite3_bind_array(sqlite3 *db, const char *sql, int rows, ...) 
 { va_list params;
   va_start(params, rows);
-  int ret = i_bind_array_va(1, db, (const void*)sql, rows, params);
+  int ret = i_bind_array_va(1, db, (const void*)sql, rows, NULL, params);
   va_end(params);
   return ret;
 }
@@ -307,24 +512,48 @@ int sqlite3_bind_array(sqlite3 *db, const char *sql, int rows, ...)
 int sqlite3_bind_array16(sqlite3 *db, const void *sql, int rows, ...) 
 { va_list params;
   va_start(params, rows);
-  int ret = i_bind_array_va(2, db, sql, rows, params);
+  int ret = i_bind_array_va(2, db, sql, rows, NULL, params);
   va_end(params);
   return ret;
 }
 /* --------------------------------------------------------------------------- */
 int sqlite3_bind_array_va(sqlite3 *db, const char *sql, int rows, va_list params) 
-{ return i_bind_array_va(1, db, (const void*)sql, rows, params);
+{ return i_bind_array_va(1, db, (const void*)sql, rows, NULL, params);
 }
 /* --------------------------------------------------------------------------- */
 int sqlite3_bind_array_va16(sqlite3 *db, const void *sql, int rows, va_list params) 
-{ return i_bind_array_va(2, db, sql, rows, params);
+{ return i_bind_array_va(2, db, sql, rows, NULL, params);
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_array_token(sqlite3 *db, const char *sql, int rows, sqlite3_bind_token *token, ...) 
+{ va_list params;
+  va_start(params, token);
+  int ret = i_bind_array_va(1, db, (const void*)sql, rows, token, params);
+  va_end(params);
+  return ret;
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_array_token16(sqlite3 *db, const void *sql, int rows, sqlite3_bind_token *token, ...) 
+{ va_list params;
+  va_start(params, token);
+  int ret = i_bind_array_va(2, db, sql, rows, token, params);
+  va_end(params);
+  return ret;
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_array_token_va(sqlite3 *db, const char *sql, int rows, sqlite3_bind_token *token, va_list params) 
+{ return i_bind_array_va(1, db, (const void*)sql, rows, token, params);
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_array_token_va16(sqlite3 *db, const void *sql, int rows, sqlite3_bind_token *token, va_list params) 
+{ return i_bind_array_va(2, db, sql, rows, token, params);
 }
 
 /* ---------------------------------------------------------------------------
 ** Bind Array implementation. 
 ** ---------------------------------------------------------------------------
 */
-static int i_bind_array_va(int sqltype, sqlite3 *db, const void *sql, int rows, va_list params)
+static int i_bind_array_va(int sqltype, sqlite3 *db, const void *sql, int rows, sqlite3_bind_token *token, va_list params)
 { g_last_err_code=SQLITE_OK;
   int i, ret=SQLITE_OK;
   sqlite3_stmt *stmt = NULL;
@@ -412,36 +641,16 @@ static int i_bind_array_va(int sqltype, sqlite3 *db, const void *sql, int rows,
 
   // now bind and execute each row of data...
   // less error checking because we did that on the first pass above.
+  // the token is checked between rows too, an interrupt is lost while no statement is running.
   int irow=0;
-  for (irow=0;((ret==SQLITE_OK)&&(irow<rows));irow++)
-  { // bind each column...
-    for (i=0;i<pcnt;i++)
-    { switch(p_types[i]) 
-      { case (1+I_SQLITE_BIND_TYPE_BLOB)   : ret = sqlite3_bind_blob    (stmt, i+1, p_pntrs_a[i][irow], (p_sizes_a[i])[irow], SQLITE_STATIC); break; 
-        case (1+I_SQLITE_BIND_TYPE_DOUBLE) : ret = sqlite3_bind_double  (stmt, i+1, ((double*)(p_pntrs_a[i]))[irow]);                         break;
-        case (1+I_SQLITE_BIND_TYPE_INT)    : ret = sqlite3_bind_int     (stmt, i+1, ((int*)(p_pntrs_a[i]))[irow]);                            break;
-        case (1+I_SQLITE_BIND_TYPE_INT64)  : ret = sqlite3_bind_int64   (stmt, i+1, ((sqlite_int64*)(p_pntrs_a[i]))[irow]);                   break;
-        case (1+I_SQLITE_BIND_TYPE_TEXT)   : ret = sqlite3_bind_text    (stmt, i+1, ((char**)(p_pntrs_a[i]))[irow], -1, SQLITE_STATIC);       break;
-        case (1+I_SQLITE_BIND_TYPE_TEXT16) : ret = sqlite3_bind_text16  (stmt, i+1, ((void**)(p_pntrs_a[i]))[irow], -1, SQLITE_STATIC);       break;
-        case (1+I_SQLITE_BIND_TYPE_ZBLOB)  : ret = sqlite3_bind_zeroblob(stmt, i+1, (int)(p_fsizes[irow]));                                   break;
-        case (1+I_SQLITE_BIND_TYPE_NULL)   : ret = sqlite3_bind_null    (stmt, i+1);                                                          break;
-        
-        //case (2+I_SQLITE_BIND_TYPE_BLOB)   : ret = sqlite3_bind_blob    (stmt, i+1, p_pntrs_a[i][irow], (p_sizes_a[i])[irow], SQLITE_STATIC); break; 
-        case (2+I_SQLITE_BIND_TYPE_TEXT)   : ret = sqlite3_bind_text    (stmt, i+1, ((char*)(p_pntrs_a[i]))+(irow*p_fsizes[i]), -1, SQLITE_STATIC);       break;
-      }
-    } // for each column to be inserted
-    
-    // process the statement with the current bindings.
-
-    // DO NOT PERMIT RESULTS!
-    if (ret==SQLITE_OK) if ((ret=sqlite3_step(stmt))==SQLITE_DONE) ret=SQLITE_OK; 
-    
-    // if needed, result processing would go here
-    //if (ret==SQLITE_OK) ret = i_handle_results(stmt, callback, arg, irow);
-
-    if (ret==SQLITE_OK) ret = sqlite3_reset(stmt);
-  
-  } // for each row to insert
+  if (ret==SQLITE_OK) 
+  { ret = i_token_attach(token, db);
+    for (irow=0;((ret==SQLITE_OK)&&(irow<rows));irow++)
+    { if ((ret=i_token_check(token))!=SQLITE_OK) break;
+      if ((ret=i_bind_array_row(stmt, pcnt, p_types, p_fsizes, p_sizes_a, p_pntrs_a, irow))==SQLITE_OK) i_token_row(token);
+    }
+    ret = i_token_detach(token, ret);
+  }
 
   // delete all the internally created stack related storage
   sqlite3_free(p_types);
@@ -459,4 +668,1313 @@ static int i_bind_array_va(int sqltype, sqlite3 *db, const void *sql, int rows,
   return ret;
 }
 
-/* EOF */
\ No newline at end of file
+/* ---------------------------------------------------------------------------
+** Bind one row of the gathered arrays and execute it. 
+** ---------------------------------------------------------------------------
+*/
+static int i_bind_array_row(sqlite3_stmt *stmt, int pcnt, unsigned int *p_types, sqlite_int64 *p_fsizes, int **p_sizes_a, void ***p_pntrs_a, int irow)
+{ int i, ret=SQLITE_OK;
+  
+  // bind each column...
+  for (i=0;((ret==SQLITE_OK)&&(i<pcnt));i++)
+  { switch(p_types[i]) 
+    { case (1+I_SQLITE_BIND_TYPE_BLOB)   : ret = sqlite3_bind_blob    (stmt, i+1, p_pntrs_a[i][irow], (p_sizes_a[i])[irow], SQLITE_STATIC); break; 
+      case (1+I_SQLITE_BIND_TYPE_DOUBLE) : ret = sqlite3_bind_double  (stmt, i+1, ((double*)(p_pntrs_a[i]))[irow]);                         break;
+      case (1+I_SQLITE_BIND_TYPE_INT)    : ret = sqlite3_bind_int     (stmt, i+1, ((int*)(p_pntrs_a[i]))[irow]);                            break;
+      case (1+I_SQLITE_BIND_TYPE_INT64)  : ret = sqlite3_bind_int64   (stmt, i+1, ((sqlite_int64*)(p_pntrs_a[i]))[irow]);                   break;
+      case (1+I_SQLITE_BIND_TYPE_TEXT)   : ret = sqlite3_bind_text    (stmt, i+1, ((char**)(p_pntrs_a[i]))[irow], -1, SQLITE_STATIC);       break;
+      case (1+I_SQLITE_BIND_TYPE_TEXT16) : ret = sqlite3_bind_text16  (stmt, i+1, ((void**)(p_pntrs_a[i]))[irow], -1, SQLITE_STATIC);       break;
+      case (1+I_SQLITE_BIND_TYPE_ZBLOB)  : ret = sqlite3_bind_zeroblob(stmt, i+1, (int)(p_fsizes[i]));                                      break;
+      case (1+I_SQLITE_BIND_TYPE_NULL)   : ret = sqlite3_bind_null    (stmt, i+1);                                                          break;
+      
+      //case (2+I_SQLITE_BIND_TYPE_BLOB)   : ret = sqlite3_bind_blob    (stmt, i+1, p_pntrs_a[i][irow], (p_sizes_a[i])[irow], SQLITE_STATIC); break; 
+      case (2+I_SQLITE_BIND_TYPE_TEXT)   : ret = sqlite3_bind_text    (stmt, i+1, ((char*)(p_pntrs_a[i]))+(irow*p_fsizes[i]), -1, SQLITE_STATIC);       break;
+    }
+  } // for each column to be inserted
+  
+  // process the statement with the current bindings.
+
+  // DO NOT PERMIT RESULTS!
+  if (ret==SQLITE_OK) if ((ret=sqlite3_step(stmt))==SQLITE_DONE) ret=SQLITE_OK; 
+  
+  // if needed, result processing would go here
+  //if (ret==SQLITE_OK) ret = i_handle_results(stmt, callback, arg, irow);
+
+  if (ret==SQLITE_OK) ret = sqlite3_reset(stmt);
+  return ret;
+}
+
+/* ***************************************************************************
+**      BIND ARRAY PULL SECTION
+** ***************************************************************************
+*/
+
+static int i_bind_array_pull_va(int sqltype, sqlite3 *db, const void *sql, int capacity, int (*fill)(void*,int,sqlite3_bind_column*,int), void *arg, va_list params);
+
+/* ---------------------------------------------------------------------------
+** Public bind_array_pull functions stage execution of i_bind_array_pull_va
+** ---------------------------------------------------------------------------
+*/
+int sqlite3_bind_array_pull(sqlite3 *db, const char *sql, int capacity, int (*fill)(void*,int,sqlite3_bind_column*,int), void *arg, ...)
+{ va_list params;
+  va_start(params, arg);
+  int ret = i_bind_array_pull_va(1, db, (const void*)sql, capacity, fill, arg, params);
+  va_end(params);
+  return ret;
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_array_pull16(sqlite3 *db, const void *sql, int capacity, int (*fill)(void*,int,sqlite3_bind_column*,int), void *arg, ...)
+{ va_list params;
+  va_start(params, arg);
+  int ret = i_bind_array_pull_va(2, db, sql, capacity, fill, arg, params);
+  va_end(params);
+  return ret;
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_array_pull_va(sqlite3 *db, const char *sql, int capacity, int (*fill)(void*,int,sqlite3_bind_column*,int), void *arg, va_list params)
+{ return i_bind_array_pull_va(1, db, (const void*)sql, capacity, fill, arg, params);
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_array_pull_va16(sqlite3 *db, const void *sql, int capacity, int (*fill)(void*,int,sqlite3_bind_column*,int), void *arg, va_list params)
+{ return i_bind_array_pull_va(2, db, sql, capacity, fill, arg, params);
+}
+
+/* ---------------------------------------------------------------------------
+** Bind Array Pull implementation. The column buffers are allocated once from
+** the stack description, then the arrays gathered for bind_array are pointed
+** at them so each filled chunk goes through the same row binding.
+** ---------------------------------------------------------------------------
+*/
+static int i_bind_array_pull_va(int sqltype, sqlite3 *db, const void *sql, int capacity, int (*fill)(void*,int,sqlite3_bind_column*,int), void *arg, va_list params)
+{ g_last_err_code=SQLITE_OK;
+  int i, ret=SQLITE_OK;
+  sqlite3_stmt *stmt = NULL;
+  
+  if ((capacity<=0)||(fill==NULL)) return SQLITE_MISUSE;
+  
+  // only one is used based on the type of null terminated sql is passed: 1=8bit and 2=16bit.
+  const char *p1_tail=(const char*)sql;
+  const void *p2_tail=sql;
+  
+  // bind_array_pull does not support multiple sql statements separated with semi-colon!
+  int pcnt=0;
+
+  if (sqltype==1) // const char *
+  { if ( (ret=sqlite3_prepare_v2(db, p1_tail, -1, &stmt, &p1_tail)) != SQLITE_OK) return ret;  
+  }
+  else // const void *
+  { if ( (ret=sqlite3_prepare16_v2(db, p2_tail, -1, &stmt, &p2_tail)) != SQLITE_OK) return ret;  
+  }
+
+  // impossible? prepare should return code above.
+  if (stmt==NULL) return SQLITE_ERROR; 
+
+#ifdef I_SQLITE_BIND_ARRAY_CANT_HAVE_RESULTS
+  if (sqlite3_column_count(stmt)>0) 
+  { sqlite3_finalize(stmt); 
+    return g_last_err_code=SQLITE_ERR_BIND_ARRAY_CANT_HAVE_RESULTS;
+  }
+#endif
+
+  pcnt = sqlite3_bind_parameter_count(stmt);
+  
+  // the column buffers handed to the producer, and the same gathered arrays bind_array uses.
+  sqlite3_bind_column *cols = (sqlite3_bind_column*)sqlite3_malloc(sizeof(sqlite3_bind_column) * (pcnt+1)); 
+  unsigned int *p_types = (unsigned int*)sqlite3_malloc(sizeof(unsigned int) * (pcnt+1)); 
+  sqlite_int64 *p_fsizes = (sqlite_int64*)sqlite3_malloc(sizeof(sqlite_int64) * (pcnt+1)); 
+  int **p_sizes_a = (int**)sqlite3_malloc(sizeof(int*) * (pcnt+1)); 
+  void ***p_pntrs_a = (void ***)sqlite3_malloc(sizeof(void**) * (pcnt+1)); 
+  
+  if ((cols==NULL)||(p_types==NULL)||(p_fsizes==NULL)||(p_sizes_a==NULL)||(p_pntrs_a==NULL)) ret=SQLITE_NOMEM;
+  else 
+  { memset(cols, 0, sizeof(sqlite3_bind_column) * (pcnt+1));
+    memset(p_sizes_a, 0, sizeof(int*) * (pcnt+1));
+    memset(p_pntrs_a, 0, sizeof(void**) * (pcnt+1));
+  }
+  
+  // gather the column types from the stack and allocate the buffers...
+  // the library keeps its own pointers to the buffers, cols only shows them to the producer.
+  for (i=0;((ret==SQLITE_OK)&&(i<pcnt));i++)
+  { 
+    p_fsizes[i]=0;
+    cols[i].type = va_arg(params, unsigned int);
+    
+    // the pull column types map onto the bind_array types: 3 becomes 1, and block text 4 becomes 2.
+    switch(cols[i].type) 
+    { 
+      case (3+I_SQLITE_BIND_TYPE_BLOB) : 
+        p_sizes_a[i] = (int*)sqlite3_malloc(sizeof(int) * capacity);
+        p_pntrs_a[i] = (void**)sqlite3_malloc(sizeof(void*) * capacity);
+        if (p_sizes_a[i]==NULL) ret=SQLITE_NOMEM;
+        break; 
+
+      case (3+I_SQLITE_BIND_TYPE_DOUBLE) : p_pntrs_a[i] = (void**)sqlite3_malloc(sizeof(double) * capacity);        break;
+      case (3+I_SQLITE_BIND_TYPE_INT)    : p_pntrs_a[i] = (void**)sqlite3_malloc(sizeof(int) * capacity);           break;
+      case (3+I_SQLITE_BIND_TYPE_INT64)  : p_pntrs_a[i] = (void**)sqlite3_malloc(sizeof(sqlite3_int64) * capacity); break;
+      case (3+I_SQLITE_BIND_TYPE_TEXT)   : p_pntrs_a[i] = (void**)sqlite3_malloc(sizeof(char*) * capacity);         break;
+      case (3+I_SQLITE_BIND_TYPE_TEXT16) : p_pntrs_a[i] = (void**)sqlite3_malloc(sizeof(void*) * capacity);         break;
+      case (3+I_SQLITE_BIND_TYPE_ZBLOB)  : p_fsizes[i] = cols[i].size = va_arg(params, int);                        break;
+      case (3+I_SQLITE_BIND_TYPE_NULL)   : break;
+
+      // fixed width strings in a block owned by the library
+      case (4+I_SQLITE_BIND_TYPE_TEXT)   : 
+        p_fsizes[i] = cols[i].size = va_arg(params, int); 
+        if (cols[i].size<=0) ret=SQLITE_MISUSE;
+        else p_pntrs_a[i] = (void**)sqlite3_malloc64((sqlite3_uint64)cols[i].size * capacity);
+        break;
+        
+      // this situation means that the stack had less params than there were param-markers in the sql. 
+      case SQLITE_BIND_END :    
+        ret=g_last_err_code=SQLITE_ERR_BIND_STACK_MISSING_PARAMS;
+        break;
+
+      // here means that we don't recognize the guide bytes on the stack.
+      default : ret=g_last_err_code=SQLITE_ERR_BIND_STACK_GUIDE_INVALID;
+    }
+    
+    if (ret!=SQLITE_OK) break;
+    if ((p_pntrs_a[i]==NULL)&&(cols[i].type!=(3+I_SQLITE_BIND_TYPE_ZBLOB))&&(cols[i].type!=(3+I_SQLITE_BIND_TYPE_NULL))) ret=SQLITE_NOMEM;
+    
+    p_types[i] = (cols[i].type==(4+I_SQLITE_BIND_TYPE_TEXT)) ? (2+I_SQLITE_BIND_TYPE_TEXT) : (cols[i].type-2);
+  }
+
+// the stack is checked before the producer is called, so a bad stack never consumes any of its rows.
+#ifndef I_SQLITE_BIND_STACK_NOT_CHECKED  
+  if (ret==SQLITE_OK) if (va_arg(params, unsigned int) != SQLITE_BIND_END) ret=g_last_err_code=SQLITE_ERR_BIND_STACK_NOT_TERMINATED;
+#endif  
+
+  // pull each chunk from the producer, then bind and execute its rows...
+  while (ret==SQLITE_OK)
+  { int irow, n;
+    
+    // show the producer the library's buffers again, in case it wrote over the descriptions.
+    for (i=0;i<pcnt;i++)
+    { cols[i].type = (p_types[i]==(2+I_SQLITE_BIND_TYPE_TEXT)) ? (4+I_SQLITE_BIND_TYPE_TEXT) : (p_types[i]+2);
+      cols[i].size = (int)p_fsizes[i];
+      cols[i].sizes = p_sizes_a[i];
+      cols[i].data = (void*)p_pntrs_a[i];
+    }
+    
+    n = fill(arg, capacity, cols, pcnt);
+    if (n==0) break; 
+    if (n<0) { ret=SQLITE_ABORT; break; }
+    if (n>capacity) { ret=SQLITE_MISUSE; break; }
+    
+    for (irow=0;((ret==SQLITE_OK)&&(irow<n));irow++)
+      ret = i_bind_array_row(stmt, pcnt, p_types, p_fsizes, p_sizes_a, p_pntrs_a, irow);
+  }
+
+  // delete the column buffers and the internally created stack related storage
+  if (p_sizes_a) for (i=0;i<pcnt;i++) sqlite3_free(p_sizes_a[i]);
+  if (p_pntrs_a) for (i=0;i<pcnt;i++) sqlite3_free(p_pntrs_a[i]);
+  sqlite3_free(cols);
+  sqlite3_free(p_types);
+  sqlite3_free(p_fsizes);
+  sqlite3_free(p_sizes_a);
+  sqlite3_free(p_pntrs_a);
+
+  sqlite3_finalize(stmt); 
+  return ret;
+}
+
+/* ***************************************************************************
+**      STATEMENT CACHE SECTION
+** ***************************************************************************
+*/
+
+/* ---------------------------------------------------------------------------
+** Idle prepared statements are kept in a list keyed by the db and the exact
+** sql bytes they were prepared from. A statement is removed from the list
+** while it is in use, so it is never shared. The list is capped, statements
+** released to a full cache are finalized.
+** ---------------------------------------------------------------------------
+*/
+#define I_SQLITE_BIND_CACHE_SIZE 32
+
+typedef struct i_stmt_entry
+{ sqlite3 *db;
+  sqlite3_stmt *stmt;
+  int sqltype;                  // 1=8bit and 2=16bit sql
+  int keylen;                   // bytes in key, without the terminator
+  void *key;                    // copy of the sql the statement was prepared from
+  struct i_stmt_entry *next;
+} i_stmt_entry;
+
+static i_stmt_entry *g_stmt_cache=NULL;
+static int g_stmt_cache_count=0;
+
+/* ---------------------------------------------------------------------------
+** The cache has its own mutex, the static APP mutexes belong to the application.
+** Without pthreads a FAST mutex is allocated on first use, under the static
+** MASTER mutex so two threads can't both allocate it.
+*/
+#ifndef I_SQLITE_BIND_OMIT_THREADS
+static pthread_mutex_t g_stmt_cache_mx = PTHREAD_MUTEX_INITIALIZER;
+static void i_cache_lock(void)   { pthread_mutex_lock(&g_stmt_cache_mx); }
+static void i_cache_unlock(void) { pthread_mutex_unlock(&g_stmt_cache_mx); }
+#else
+static sqlite3_mutex *g_stmt_cache_mx=NULL;
+static void i_cache_lock(void)
+{ if (g_stmt_cache_mx==NULL)
+  { sqlite3_mutex *master = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_MASTER);
+    sqlite3_mutex_enter(master);
+    if (g_stmt_cache_mx==NULL) g_stmt_cache_mx = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+    sqlite3_mutex_leave(master);
+  }
+  sqlite3_mutex_enter(g_stmt_cache_mx);
+}
+static void i_cache_unlock(void) { sqlite3_mutex_leave(g_stmt_cache_mx); }
+#endif
+
+/* ---------------------------------------------------------------------------
+** Length in bytes of either sql format.
+*/
+static int i_sql_bytes(int sqltype, const void *sql)
+{ if (sqltype==1) return (int)strlen((const char*)sql);
+  const unsigned short *p=(const unsigned short*)sql;
+  while (*p) p++;
+  return (int)((const char*)p-(const char*)sql);
+}
+
+/* ---------------------------------------------------------------------------
+** Take a cached statement for the sql, or prepare a new one. Only the first
+** statement of the sql is prepared.
+*/
+static int i_stmt_acquire(int sqltype, sqlite3 *db, const void *sql, i_stmt_entry **entry)
+{ int ret=SQLITE_OK, keylen=i_sql_bytes(sqltype, sql);
+  i_stmt_entry *e, **pe;
+  *entry=NULL;
+  i_cache_lock();
+  for (pe=&g_stmt_cache;(*pe)!=NULL;pe=&((*pe)->next))
+  { e=*pe;
+    if ((e->db==db)&&(e->sqltype==sqltype)&&(e->keylen==keylen)&&(memcmp(e->key, sql, keylen)==0))
+    { *pe=e->next; 
+      e->next=NULL;
+      g_stmt_cache_count--;
+      *entry=e;
+      break;
+    }
+  }
+  i_cache_unlock();
+  if (*entry) return SQLITE_OK;
+  
+  // not cached, so prepare it...
+  e = (i_stmt_entry*)sqlite3_malloc(sizeof(i_stmt_entry));
+  if (e==NULL) return SQLITE_NOMEM;
+  memset(e, 0, sizeof(i_stmt_entry));
+  e->db=db;
+  e->sqltype=sqltype;
+  e->keylen=keylen;
+  e->key=sqlite3_malloc(keylen+2);
+  if (e->key==NULL) { sqlite3_free(e); return SQLITE_NOMEM; }
+  memcpy(e->key, sql, keylen);
+  
+  if (sqltype==1) ret=sqlite3_prepare_v2(db, (const char*)sql, -1, &(e->stmt), NULL);
+  else ret=sqlite3_prepare16_v2(db, sql, -1, &(e->stmt), NULL);
+  
+  // empty sql prepares to a NULL statement, which is no use to the caller.
+  if ((ret==SQLITE_OK)&&(e->stmt==NULL)) ret=SQLITE_MISUSE;
+  if (ret!=SQLITE_OK)
+  { sqlite3_finalize(e->stmt);
+    sqlite3_free(e->key);
+    sqlite3_free(e);
+    return ret;
+  }
+  *entry=e;
+  return SQLITE_OK;
+}
+
+/* ---------------------------------------------------------------------------
+** Return a statement to the cache, clean of rows and bindings.
+*/
+static void i_stmt_release(i_stmt_entry *e)
+{ if (e==NULL) return;
+  sqlite3_reset(e->stmt);
+  sqlite3_clear_bindings(e->stmt);
+  
+  i_cache_lock();
+  if (g_stmt_cache_count<I_SQLITE_BIND_CACHE_SIZE)
+  { e->next=g_stmt_cache;
+    g_stmt_cache=e;
+    g_stmt_cache_count++;
+    e=NULL;
+  }
+  i_cache_unlock();
+  
+  // the cache is full
+  if (e)
+  { sqlite3_finalize(e->stmt);
+    sqlite3_free(e->key);
+    sqlite3_free(e);
+  }
+}
+
+/* ---------------------------------------------------------------------------
+** Public function to finalize the idle cached statements of a db, or all
+** of them if db is NULL. Statements held by open cursors are not touched.
+** ---------------------------------------------------------------------------
+*/
+int sqlite3_bind_cache_clear(sqlite3 *db)
+{ i_stmt_entry *e, **pe, *dead=NULL;
+  i_cache_lock();
+  pe=&g_stmt_cache;
+  while ((e=*pe)!=NULL)
+  { if ((db==NULL)||(e->db==db)) 
+    { *pe=e->next; 
+      e->next=dead; 
+      dead=e; 
+      g_stmt_cache_count--;
+    }
+    else pe=&(e->next);
+  }
+  i_cache_unlock();
+  
+  while ((e=dead)!=NULL)
+  { dead=e->next;
+    sqlite3_finalize(e->stmt);
+    sqlite3_free(e->key);
+    sqlite3_free(e);
+  }
+  return SQLITE_OK;
+}
+
+/* ***************************************************************************
+**      CURSOR SECTION
+** ***************************************************************************
+*/
+
+struct sqlite3_bind_cursor
+{ i_stmt_entry *entry;          // the statement, owned by the cursor until closed
+  int rc;                       // SQLITE_DONE once exhausted, or the error that ended it, 0 while active
+};
+
+static int i_bind_cursor_open_va(int sqltype, sqlite3 *db, const void *sql, sqlite3_bind_cursor **cursor, va_list params);
+
+/* ---------------------------------------------------------------------------
+** Public cursor_open functions stage execution of i_bind_cursor_open_va
+** ---------------------------------------------------------------------------
+*/
+int sqlite3_bind_cursor_open(sqlite3 *db, const char *sql, sqlite3_bind_cursor **cursor, ...)
+{ va_list params;
+  va_start(params, cursor);
+  int ret = i_bind_cursor_open_va(1, db, (const void*)sql, cursor, params);
+  va_end(params);
+  return ret;
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_cursor_open16(sqlite3 *db, const void *sql, sqlite3_bind_cursor **cursor, ...)
+{ va_list params;
+  va_start(params, cursor);
+  int ret = i_bind_cursor_open_va(2, db, sql, cursor, params);
+  va_end(params);
+  return ret;
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_cursor_open_va(sqlite3 *db, const char *sql, sqlite3_bind_cursor **cursor, va_list params)
+{ return i_bind_cursor_open_va(1, db, (const void*)sql, cursor, params);
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_cursor_open_va16(sqlite3 *db, const void *sql, sqlite3_bind_cursor **cursor, va_list params)
+{ return i_bind_cursor_open_va(2, db, sql, cursor, params);
+}
+
+/* ---------------------------------------------------------------------------
+** Cursor Open implementation. Nothing is stepped until the first _next.
+** ---------------------------------------------------------------------------
+*/
+static int i_bind_cursor_open_va(int sqltype, sqlite3 *db, const void *sql, sqlite3_bind_cursor **cursor, va_list params)
+{ g_last_err_code=SQLITE_OK;
+  int ret=SQLITE_OK;
+  i_stmt_entry *e=NULL;
+  
+  if (cursor==NULL) return SQLITE_MISUSE;
+  *cursor=NULL;
+  
+  if ((ret=i_stmt_acquire(sqltype, db, sql, &e))!=SQLITE_OK) return ret;
+  
+  va_list ap;
+  va_copy(ap, params);
+  ret = i_bind_params(e->stmt, sqlite3_bind_parameter_count(e->stmt), &ap);
+  
+#ifndef I_SQLITE_BIND_STACK_NOT_CHECKED  
+  if (ret==SQLITE_OK) if (va_arg(ap, unsigned int) != SQLITE_BIND_END) ret=g_last_err_code=SQLITE_ERR_BIND_STACK_NOT_TERMINATED;
+#endif  
+  va_end(ap);
+  
+  if (ret==SQLITE_OK)
+  { *cursor = (sqlite3_bind_cursor*)sqlite3_malloc(sizeof(sqlite3_bind_cursor));
+    if (*cursor==NULL) ret=SQLITE_NOMEM;
+  }
+  if (ret!=SQLITE_OK) 
+  { i_stmt_release(e);
+    return ret;
+  }
+  (*cursor)->entry=e;
+  (*cursor)->rc=0;
+  return SQLITE_OK;
+}
+
+/* ---------------------------------------------------------------------------
+** Fetch the next batch of rows. Once the query is done (or failed) the
+** statement is reset so it holds no read lock while the cursor stays open,
+** and stepping is not repeated (which would restart the query), later calls
+** return the same code.
+** ---------------------------------------------------------------------------
+*/
+int sqlite3_bind_cursor_next(sqlite3_bind_cursor *cursor, int rows, int (*callback)(void*,sqlite3_stmt*,int), void *arg, int *fetched)
+{ g_last_err_code=SQLITE_OK;
+  int row=0, ret=SQLITE_ROW;
+  
+  if (fetched) *fetched=0;
+  if ((cursor==NULL)||(rows<=0)) return SQLITE_MISUSE;
+  if (cursor->rc) return cursor->rc;
+  
+  sqlite3_stmt *stmt = cursor->entry->stmt;
+  while (row<rows)
+  { int r = sqlite3_step(stmt);
+    if (r != SQLITE_ROW) 
+    { ret=cursor->rc=r; 
+      sqlite3_reset(stmt);
+      break;
+    }
+    row++;
+    if (callback) if (callback(arg, stmt, row-1) != 0) break; // short circuit the batch
+  }
+  
+  if (fetched) *fetched=row;
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------
+** Rewind the cursor to the first row, the bound params are kept.
+** ---------------------------------------------------------------------------
+*/
+int sqlite3_bind_cursor_reset(sqlite3_bind_cursor *cursor)
+{ if (cursor==NULL) return SQLITE_MISUSE;
+  cursor->rc=0;
+  sqlite3_reset(cursor->entry->stmt);
+  return SQLITE_OK;
+}
+
+/* ---------------------------------------------------------------------------
+** Close the cursor and return its statement to the cache.
+** ---------------------------------------------------------------------------
+*/
+int sqlite3_bind_cursor_close(sqlite3_bind_cursor *cursor)
+{ if (cursor==NULL) return SQLITE_OK;
+  i_stmt_release(cursor->entry);
+  sqlite3_free(cursor);
+  return SQLITE_OK;
+}
+
+/* ***************************************************************************
+**      COMPILED SCRIPT SECTION
+** ***************************************************************************
+*/
+
+struct sqlite3_bind_script
+{ sqlite3 *db;
+  int count;                    // statements in the script
+  int total;                    // params over all the statements
+  sqlite3_stmt **stmts;
+  int *pcnts;                   // params of each statement
+  sqlite3_stmt *begin, *commit, *rollback;
+};
+
+/* ---------------------------------------------------------------------------
+** Public script_compile functions stage execution of i_bind_script_compile
+** ---------------------------------------------------------------------------
+*/
+static int i_bind_script_compile(int sqltype, sqlite3 *db, const void *sql, sqlite3_bind_script **script);
+
+int sqlite3_bind_script_compile(sqlite3 *db, const char *sql, sqlite3_bind_script **script)
+{ return i_bind_script_compile(1, db, (const void*)sql, script);
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_script_compile16(sqlite3 *db, const void *sql, sqlite3_bind_script **script)
+{ return i_bind_script_compile(2, db, sql, script);
+}
+
+/* ---------------------------------------------------------------------------
+** Script Compile implementation, prepares each semi-colon separated
+** statement once, the same way bind_exec walks them.
+** ---------------------------------------------------------------------------
+*/
+static int i_bind_script_compile(int sqltype, sqlite3 *db, const void *sql, sqlite3_bind_script **script)
+{ g_last_err_code=SQLITE_OK;
+  int ret=SQLITE_OK, cap=0;
+  sqlite3_stmt *stmt = NULL;
+  
+  if ((script==NULL)||(sql==NULL)) return SQLITE_MISUSE;
+  *script=NULL;
+  
+  sqlite3_bind_script *sc = (sqlite3_bind_script*)sqlite3_malloc(sizeof(sqlite3_bind_script));
+  if (sc==NULL) return SQLITE_NOMEM;
+  memset(sc, 0, sizeof(sqlite3_bind_script));
+  sc->db=db;
+  
+  // only one is used based on the type of null terminated sql is passed: 1=8bit and 2=16bit.
+  const char *p1_tail=(sqltype==1)?(const char*)sql:NULL;
+  const void *p2_tail=(sqltype==2)?sql:NULL;
+  
+  // for each semi-colon separated statement in the sql...
+  while ((ret==SQLITE_OK) && (i_check_tail(sqltype, p1_tail, p2_tail)))
+  { if (sqltype==1) ret=sqlite3_prepare_v2(db, p1_tail, -1, &stmt, &p1_tail);
+    else ret=sqlite3_prepare16_v2(db, p2_tail, -1, &stmt, &p2_tail);
+    if (ret!=SQLITE_OK) break;
+    
+    // nothing but a comment was left in the sql.
+    if (stmt==NULL) continue;
+    
+    if (sc->count==cap)
+    { cap = (cap==0) ? 4 : cap*2;
+      sqlite3_stmt **ns = (sqlite3_stmt**)sqlite3_realloc(sc->stmts, sizeof(sqlite3_stmt*) * cap);
+      if (ns!=NULL) sc->stmts=ns;
+      int *np = (int*)sqlite3_realloc(sc->pcnts, sizeof(int) * cap);
+      if (np!=NULL) sc->pcnts=np;
+      if ((ns==NULL)||(np==NULL)) { sqlite3_finalize(stmt); ret=SQLITE_NOMEM; break; }
+    }
+    sc->stmts[sc->count] = stmt;
+    sc->pcnts[sc->count] = sqlite3_bind_parameter_count(stmt);
+    sc->total += sc->pcnts[sc->count];
+    sc->count++;
+  }
+  
+  // the transaction statements are prepared now too, so a run does no parsing at all.
+  if (ret==SQLITE_OK) ret=sqlite3_prepare_v2(db, "BEGIN", -1, &sc->begin, NULL);
+  if (ret==SQLITE_OK) ret=sqlite3_prepare_v2(db, "COMMIT", -1, &sc->commit, NULL);
+  if (ret==SQLITE_OK) ret=sqlite3_prepare_v2(db, "ROLLBACK", -1, &sc->rollback, NULL);
+  
+  if (ret!=SQLITE_OK) 
+  { sqlite3_bind_script_free(sc);
+    return ret;
+  }
+  *script=sc;
+  return SQLITE_OK;
+}
+
+/* ---------------------------------------------------------------------------
+** Statement count, and params needed by statement i (all of them if i<0).
+** ---------------------------------------------------------------------------
+*/
+int sqlite3_bind_script_count(sqlite3_bind_script *script)
+{ return (script) ? script->count : 0;
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_script_params(sqlite3_bind_script *script, int i)
+{ if (script==NULL) return 0;
+  if (i<0) return script->total;
+  return (i<script->count) ? script->pcnts[i] : 0;
+}
+
+/* ---------------------------------------------------------------------------
+** Public script_exec functions stage execution of i_bind_script_exec_va
+** ---------------------------------------------------------------------------
+*/
+static int i_bind_script_exec_va(sqlite3_bind_script *script, int flags, int (*callback)(void*,sqlite3_stmt*,int), void *arg, va_list params);
+
+int sqlite3_bind_script_exec(sqlite3_bind_script *script, int flags, int (*callback)(void*,sqlite3_stmt*,int), void *arg, ...)
+{ va_list params;
+  va_start(params, arg);
+  int ret = i_bind_script_exec_va(script, flags, callback, arg, params);
+  va_end(params);
+  return ret;
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_script_exec_va(sqlite3_bind_script *script, int flags, int (*callback)(void*,sqlite3_stmt*,int), void *arg, va_list params)
+{ return i_bind_script_exec_va(script, flags, callback, arg, params);
+}
+
+/* ---------------------------------------------------------------------------
+** Step a prepared statement to the end, rows go to the callback. A non-zero
+** return from the callback ends the rows of that statement, like bind_exec.
+*/
+static int i_script_step(sqlite3_stmt *stmt, int istmt, int (*callback)(void*,sqlite3_stmt*,int), void *arg)
+{ int ret=SQLITE_OK;
+  for (;;)
+  { int r = sqlite3_step(stmt);
+    if (r==SQLITE_DONE) break;
+    if (r!=SQLITE_ROW) { ret=r; break; }
+    if (callback) if (callback(arg, stmt, istmt)!=0) break;
+  }
+  sqlite3_reset(stmt);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------
+** Script Exec implementation. The whole stack is bound before anything runs,
+** so a short or unterminated stack fails without executing any statement.
+** ---------------------------------------------------------------------------
+*/
+static int i_bind_script_exec_va(sqlite3_bind_script *script, int flags, int (*callback)(void*,sqlite3_stmt*,int), void *arg, va_list params)
+{ g_last_err_code=SQLITE_OK;
+  int i, ret=SQLITE_OK;
+  
+  if (script==NULL) return SQLITE_MISUSE;
+  
+  va_list ap;
+  va_copy(ap, params);
+  for (i=0;((ret==SQLITE_OK)&&(i<script->count));i++) ret = i_bind_params(script->stmts[i], script->pcnts[i], &ap);
+  
+#ifndef I_SQLITE_BIND_STACK_NOT_CHECKED  
+  if (ret==SQLITE_OK) if (va_arg(ap, unsigned int) != SQLITE_BIND_END) ret=g_last_err_code=SQLITE_ERR_BIND_STACK_NOT_TERMINATED;
+#endif  
+  va_end(ap);
+  
+  int in_trans = 0;
+  if ((ret==SQLITE_OK)&&(flags & SQLITE_BIND_SCRIPT_TRANSACTION))
+  { if ((ret=i_script_step(script->begin, -1, NULL, NULL))==SQLITE_OK) in_trans=1;
+  }
+  
+  // step each statement in order, stop at the first failure.
+  for (i=0;((ret==SQLITE_OK)&&(i<script->count));i++) ret = i_script_step(script->stmts[i], i, callback, arg);
+  
+  if (in_trans)
+  { if (ret==SQLITE_OK) ret = i_script_step(script->commit, -1, NULL, NULL);
+    if (ret!=SQLITE_OK) i_script_step(script->rollback, -1, NULL, NULL);
+  }
+  
+  // the params are bound SQLITE_STATIC, don't keep the caller's pointers past the call.
+  for (i=0;i<script->count;i++) sqlite3_clear_bindings(script->stmts[i]);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------
+** Finalize all the statements of the script.
+** ---------------------------------------------------------------------------
+*/
+int sqlite3_bind_script_free(sqlite3_bind_script *script)
+{ int i;
+  if (script==NULL) return SQLITE_OK;
+  for (i=0;i<script->count;i++) sqlite3_finalize(script->stmts[i]);
+  sqlite3_finalize(script->begin);
+  sqlite3_finalize(script->commit);
+  sqlite3_finalize(script->rollback);
+  sqlite3_free(script->stmts);
+  sqlite3_free(script->pcnts);
+  sqlite3_free(script);
+  return SQLITE_OK;
+}
+
+#ifndef I_SQLITE_BIND_OMIT_THREADS
+
+/* ***************************************************************************
+**      CAPTURED PARAMS SECTION
+** ***************************************************************************
+*/
+
+/* ---------------------------------------------------------------------------
+** A stack param copied off the va_list, so it can be bound later or on
+** another thread. Text and blob values are still the caller's pointers.
+*/
+typedef struct i_bind_value
+{ unsigned int type;            // the guide marker
+  int size;                     // BLOB and ZBLOB size
+  union 
+  { double dbl;
+    int ni;
+    sqlite3_int64 i8;
+    const void *vp;
+  } v;
+} i_bind_value;
+
+/* ---------------------------------------------------------------------------
+** Copy the stack params up to the end marker into a new array. The end 
+** marker is required here, even if the stack is not checked elsewhere.
+*/
+static int i_capture_params(va_list *params, i_bind_value **vals, int *count)
+{ int n=0, cap=8, ret=SQLITE_OK;
+  i_bind_value *a = (i_bind_value*)sqlite3_malloc(sizeof(i_bind_value) * cap);
+  
+  *vals=NULL;
+  *count=0;
+  if (a==NULL) return SQLITE_NOMEM;
+  
+  while (ret==SQLITE_OK)
+  { unsigned int guide = va_arg(*params, unsigned int);
+    if (guide==SQLITE_BIND_END) break;
+    
+    if (n==cap)
+    { i_bind_value *b = (i_bind_value*)sqlite3_realloc(a, sizeof(i_bind_value) * cap * 2);
+      if (b==NULL) { ret=SQLITE_NOMEM; break; }
+      a=b;
+      cap*=2;
+    }
+    a[n].type=guide;
+    a[n].size=0;
+    
+    switch(guide)
+    { case I_SQLITE_BIND_TYPE_BLOB   : a[n].size = va_arg(*params, int); a[n].v.vp = va_arg(*params, const void*); break; 
+      case I_SQLITE_BIND_TYPE_DOUBLE : a[n].v.dbl = va_arg(*params, double);                                       break;
+      case I_SQLITE_BIND_TYPE_INT    : a[n].v.ni = va_arg(*params, int);                                           break;
+      case I_SQLITE_BIND_TYPE_INT64  : a[n].v.i8 = va_arg(*params, sqlite3_int64);                                 break;
+      case I_SQLITE_BIND_TYPE_NULL   :                                                                             break;
+      case I_SQLITE_BIND_TYPE_TEXT   : a[n].v.vp = va_arg(*params, const char*);                                   break;
+      case I_SQLITE_BIND_TYPE_TEXT16 : a[n].v.vp = va_arg(*params, const void*);                                   break;
+      case I_SQLITE_BIND_TYPE_ZBLOB  : a[n].size = va_arg(*params, int);                                           break;
+      
+      // here means that we don't recognize the guide bytes on the stack.
+      default : ret=g_last_err_code=SQLITE_ERR_BIND_STACK_GUIDE_INVALID;
+    }
+    n++;
+  }
+  
+  if (ret!=SQLITE_OK) { sqlite3_free(a); return ret; }
+  *vals=a;
+  *count=n;
+  return SQLITE_OK;
+}
+
+/* ---------------------------------------------------------------------------
+** Bind pcnt captured values to the statement params, starting at param first+1.
+*/
+static int i_bind_values(sqlite3_stmt *stmt, const i_bind_value *vals, int first, int pcnt)
+{ int i, ret=SQLITE_OK;
+  for (i=0;((ret==SQLITE_OK)&&(i<pcnt));i++)
+  { const i_bind_value *pv = vals+i;
+    switch(pv->type)
+    { case I_SQLITE_BIND_TYPE_BLOB   : ret = sqlite3_bind_blob    (stmt, first+i+1, pv->v.vp, pv->size, SQLITE_STATIC);    break;
+      case I_SQLITE_BIND_TYPE_DOUBLE : ret = sqlite3_bind_double  (stmt, first+i+1, pv->v.dbl);                            break;
+      case I_SQLITE_BIND_TYPE_INT    : ret = sqlite3_bind_int     (stmt, first+i+1, pv->v.ni);                             break;
+      case I_SQLITE_BIND_TYPE_INT64  : ret = sqlite3_bind_int64   (stmt, first+i+1, pv->v.i8);                             break;
+      case I_SQLITE_BIND_TYPE_NULL   : ret = sqlite3_bind_null    (stmt, first+i+1);                                       break;
+      case I_SQLITE_BIND_TYPE_TEXT   : ret = sqlite3_bind_text    (stmt, first+i+1, (const char*)pv->v.vp, -1, SQLITE_STATIC); break;
+      case I_SQLITE_BIND_TYPE_TEXT16 : ret = sqlite3_bind_text16  (stmt, first+i+1, pv->v.vp, -1, SQLITE_STATIC);          break;
+      case I_SQLITE_BIND_TYPE_ZBLOB  : ret = sqlite3_bind_zeroblob(stmt, first+i+1, pv->size);                             break;
+    }
+  }
+  return ret;
+}
+
+/* ***************************************************************************
+**      WRITE BATCH SECTION
+** ***************************************************************************
+*/
+
+/* ---------------------------------------------------------------------------
+** Group commit. Submitting threads push requests on a lock-free stack, and
+** a single writer thread takes them all at once, restores submit order, and
+** runs up to max_batch of them in one transaction. Each request runs inside
+** its own savepoint, so a failed request is rolled back without failing the
+** others in its batch. Submitters wait on a shared condition until the
+** writer marks their request done.
+** ---------------------------------------------------------------------------
+*/
+typedef struct i_batch_req
+{ int sqltype;                  // 1=8bit and 2=16bit sql
+  const void *sql;
+  i_bind_value *vals;
+  int nvals;
+  int ret;                      // the result for the submitter
+  int done;                     // set by the writer, under the batch mutex
+  struct i_batch_req *next;
+} i_batch_req;
+
+struct sqlite3_bind_batch
+{ sqlite3 *db;                  // owned by the writer thread while the batch is open
+  int max_batch;
+  int max_wait_ms;
+  _Atomic(i_batch_req*) head;   // submitted requests, newest first
+  atomic_int sleeping;          // the writer is (about to be) waiting for requests
+  atomic_int closing;
+  pthread_t writer;
+  pthread_mutex_t mx;
+  pthread_cond_t wake;          // signals the writer
+  pthread_cond_t done;          // signals the submitters
+};
+
+/* ---------------------------------------------------------------------------
+** Run a statement from the cache, discarding any rows.
+*/
+static int i_batch_step(sqlite3 *db, int sqltype, const void *sql, const i_bind_value *vals, int nvals)
+{ int ret=SQLITE_OK, pcnt;
+  i_stmt_entry *e=NULL;
+  
+  if ((ret=i_stmt_acquire(sqltype, db, sql, &e))!=SQLITE_OK) return ret;
+  pcnt = sqlite3_bind_parameter_count(e->stmt);
+  if (nvals<pcnt) ret=SQLITE_ERR_BIND_STACK_MISSING_PARAMS;
+  else if (nvals>pcnt) ret=SQLITE_ERR_BIND_STACK_NOT_TERMINATED;
+  else ret = i_bind_values(e->stmt, vals, 0, pcnt);
+  
+  while (ret==SQLITE_OK) 
+  { int r = sqlite3_step(e->stmt);
+    if (r==SQLITE_DONE) break;
+    if (r!=SQLITE_ROW) ret=r;
+  }
+  i_stmt_release(e);
+  return ret;
+}
+
+/* ---------------------------------------------------------------------------
+** Wait for requests, until abstime if given. Returns with the mutex released.
+*/
+static void i_batch_wait(sqlite3_bind_batch *batch, const struct timespec *abstime)
+{ pthread_mutex_lock(&batch->mx);
+  atomic_store(&batch->sleeping, 1);
+  // re-check after announcing the sleep, a submitter that missed the flag pushed before it was set.
+  if ((atomic_load(&batch->head)==NULL)&&(!atomic_load(&batch->closing)))
+  { if (abstime) pthread_cond_timedwait(&batch->wake, &batch->mx, abstime);
+    else pthread_cond_wait(&batch->wake, &batch->mx);
+  }
+  atomic_store(&batch->sleeping, 0);
+  pthread_mutex_unlock(&batch->mx);
+}
+
+/* ---------------------------------------------------------------------------
+** Move all submitted requests to the end of the local queue, in submit order.
+*/
+static int i_batch_take(sqlite3_bind_batch *batch, i_batch_req **first, i_batch_req **last)
+{ int n=0;
+  i_batch_req *r = atomic_exchange(&batch->head, NULL), *fifo=NULL, *tail=r;
+  while (r) 
+  { i_batch_req *next=r->next; 
+    r->next=fifo; 
+    fifo=r; 
+    r=next; 
+    n++; 
+  }
+  if (fifo==NULL) return 0;
+  if (*last) (*last)->next=fifo; else *first=fifo;
+  *last=tail;
+  return n;
+}
+
+/* ---------------------------------------------------------------------------
+** The writer thread.
+*/
+static void *i_batch_writer(void *arg)
+{ sqlite3_bind_batch *batch = (sqlite3_bind_batch*)arg;
+  i_batch_req *first=NULL, *last=NULL;
+  int queued=0;
+  
+  for (;;)
+  { queued += i_batch_take(batch, &first, &last);
+    if (queued==0)
+    { if (atomic_load(&batch->closing)) break;
+      i_batch_wait(batch, NULL);
+      continue;
+    }
+    
+    // give the batch up to max_wait_ms to fill.
+    if ((queued<batch->max_batch)&&(batch->max_wait_ms>0)&&(!atomic_load(&batch->closing)))
+    { struct timespec until;
+      clock_gettime(CLOCK_REALTIME, &until);
+      until.tv_sec += batch->max_wait_ms/1000;
+      until.tv_nsec += (long)(batch->max_wait_ms%1000)*1000000L;
+      if (until.tv_nsec>=1000000000L) { until.tv_sec++; until.tv_nsec-=1000000000L; }
+      
+      for (;;)
+      { struct timespec now;
+        queued += i_batch_take(batch, &first, &last);
+        if ((queued>=batch->max_batch)||(atomic_load(&batch->closing))) break;
+        clock_gettime(CLOCK_REALTIME, &now);
+        if ((now.tv_sec>until.tv_sec)||((now.tv_sec==until.tv_sec)&&(now.tv_nsec>=until.tv_nsec))) break;
+        i_batch_wait(batch, &until);
+      }
+    }
+    
+    // cut the batch from the front of the queue.
+    i_batch_req *batch_first=first, *r=first;
+    int n=1, ret;
+    while ((n<batch->max_batch)&&(r->next)) { r=r->next; n++; }
+    first=r->next;
+    if (first==NULL) last=NULL;
+    r->next=NULL;
+    queued-=n;
+    
+    // run it in one transaction, each request in its own savepoint.
+    ret = i_batch_step(batch->db, 1, "BEGIN", NULL, 0);
+    for (r=batch_first;r;r=r->next)
+    { int lost=0;
+      if (ret!=SQLITE_OK) { r->ret=ret; continue; }
+      if ((r->ret=i_batch_step(batch->db, 1, "SAVEPOINT sqlite3_bind_batch", NULL, 0))==SQLITE_OK)
+      { r->ret = i_batch_step(batch->db, r->sqltype, r->sql, r->vals, r->nvals);
+        if (r->ret!=SQLITE_OK) lost = (i_batch_step(batch->db, 1, "ROLLBACK TO sqlite3_bind_batch", NULL, 0)!=SQLITE_OK);
+        if (!lost) i_batch_step(batch->db, 1, "RELEASE sqlite3_bind_batch", NULL, 0);
+      }
+      // sqlite ends the transaction on its own after some errors (OR ROLLBACK, FULL, IOERR, NOMEM), 
+      // a savepoint run now would open a transaction of its own.
+      if ((r->ret!=SQLITE_OK)&&((lost)||(sqlite3_get_autocommit(batch->db)))) break;
+    }
+    
+    // a lost transaction took the requests before r with it. The rest go back to the front
+    // of the queue for the next batch.
+    if (r)
+    { i_batch_req *p, *tail=NULL;
+      if (!sqlite3_get_autocommit(batch->db)) i_batch_step(batch->db, 1, "ROLLBACK", NULL, 0);
+      for (p=batch_first;p!=r;p=p->next) if (p->ret==SQLITE_OK) p->ret=SQLITE_ABORT;
+      for (p=r->next;p;p=p->next) { tail=p; queued++; }
+      if (tail) 
+      { tail->next=first; 
+        if (first==NULL) last=tail;
+        first=r->next;
+      }
+      r->next=NULL;
+      ret=r->ret;
+    }
+    
+    // a failed commit fails every request that had succeeded.
+    if (ret==SQLITE_OK)
+    { if ((ret=i_batch_step(batch->db, 1, "COMMIT", NULL, 0))!=SQLITE_OK)
+      { i_batch_step(batch->db, 1, "ROLLBACK", NULL, 0);
+        for (r=batch_first;r;r=r->next) if (r->ret==SQLITE_OK) r->ret=ret;
+      }
+    }
+    
+    // wake the submitters, the requests belong to them again once done is set.
+    pthread_mutex_lock(&batch->mx);
+    for (r=batch_first;r;) { i_batch_req *next=r->next; r->done=1; r=next; }
+    pthread_cond_broadcast(&batch->done);
+    pthread_mutex_unlock(&batch->mx);
+  }
+  return NULL;
+}
+
+/* ---------------------------------------------------------------------------
+** Public batch functions.
+** ---------------------------------------------------------------------------
+*/
+int sqlite3_bind_batch_open(sqlite3 *db, int max_batch, int max_wait_ms, sqlite3_bind_batch **batch)
+{ if ((db==NULL)||(batch==NULL)) return SQLITE_MISUSE;
+  *batch = (sqlite3_bind_batch*)sqlite3_malloc(sizeof(sqlite3_bind_batch));
+  if (*batch==NULL) return SQLITE_NOMEM;
+  
+  sqlite3_bind_batch *b = *batch;
+  memset(b, 0, sizeof(sqlite3_bind_batch));
+  b->db=db;
+  b->max_batch=(max_batch>0)?max_batch:1;
+  b->max_wait_ms=(max_wait_ms>0)?max_wait_ms:0;
+  atomic_init(&b->head, NULL);
+  atomic_init(&b->sleeping, 0);
+  atomic_init(&b->closing, 0);
+  pthread_mutex_init(&b->mx, NULL);
+  pthread_cond_init(&b->wake, NULL);
+  pthread_cond_init(&b->done, NULL);
+  
+  if (pthread_create(&b->writer, NULL, i_batch_writer, b)!=0)
+  { pthread_cond_destroy(&b->done);
+    pthread_cond_destroy(&b->wake);
+    pthread_mutex_destroy(&b->mx);
+    sqlite3_free(b);
+    *batch=NULL;
+    return SQLITE_ERROR;
+  }
+  return SQLITE_OK;
+}
+
+/* ---------------------------------------------------------------------------
+** Submit a request and wait for the batch that runs it to commit.
+*/
+static int i_bind_batch_exec_va(int sqltype, sqlite3_bind_batch *batch, const void *sql, va_list params)
+{ i_batch_req req;
+  int ret;
+  
+  if ((batch==NULL)||(sql==NULL)) return SQLITE_MISUSE;
+  if (atomic_load(&batch->closing)) return SQLITE_MISUSE;
+  
+  memset(&req, 0, sizeof(req));
+  req.sqltype=sqltype;
+  req.sql=sql;
+  
+  va_list ap;
+  va_copy(ap, params);
+  ret = i_capture_params(&ap, &req.vals, &req.nvals);
+  va_end(ap);
+  if (ret!=SQLITE_OK) return ret;
+  
+  // lock-free push, then wake the writer only if it may be waiting.
+  i_batch_req *head = atomic_load(&batch->head);
+  do { req.next=head; } while (!atomic_compare_exchange_weak(&batch->head, &head, &req));
+  if (atomic_load(&batch->sleeping))
+  { pthread_mutex_lock(&batch->mx);
+    pthread_cond_signal(&batch->wake);
+    pthread_mutex_unlock(&batch->mx);
+  }
+  
+  pthread_mutex_lock(&batch->mx);
+  while (!req.done) pthread_cond_wait(&batch->done, &batch->mx);
+  pthread_mutex_unlock(&batch->mx);
+  
+  sqlite3_free(req.vals);
+  return req.ret;
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_batch_exec(sqlite3_bind_batch *batch, const char *sql, ...)
+{ va_list params;
+  va_start(params, sql);
+  int ret = i_bind_batch_exec_va(1, batch, (const void*)sql, params);
+  va_end(params);
+  return ret;
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_batch_exec16(sqlite3_bind_batch *batch, const void *sql, ...)
+{ va_list params;
+  va_start(params, sql);
+  int ret = i_bind_batch_exec_va(2, batch, sql, params);
+  va_end(params);
+  return ret;
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_batch_exec_va(sqlite3_bind_batch *batch, const char *sql, va_list params)
+{ return i_bind_batch_exec_va(1, batch, (const void*)sql, params);
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_batch_exec_va16(sqlite3_bind_batch *batch, const void *sql, va_list params)
+{ return i_bind_batch_exec_va(2, batch, sql, params);
+}
+
+/* ---------------------------------------------------------------------------
+** Run what is queued, then stop the writer. No submit may be in flight.
+** The statements the writer cached for the db are finalized, so the db
+** can be closed.
+*/
+int sqlite3_bind_batch_close(sqlite3_bind_batch *batch)
+{ if (batch==NULL) return SQLITE_OK;
+  pthread_mutex_lock(&batch->mx);
+  atomic_store(&batch->closing, 1);
+  pthread_cond_signal(&batch->wake);
+  pthread_mutex_unlock(&batch->mx);
+  
+  pthread_join(batch->writer, NULL);
+  sqlite3_bind_cache_clear(batch->db);
+  pthread_cond_destroy(&batch->done);
+  pthread_cond_destroy(&batch->wake);
+  pthread_mutex_destroy(&batch->mx);
+  sqlite3_free(batch);
+  return SQLITE_OK;
+}
+
+/* ***************************************************************************
+**      PARALLEL SCAN SECTION
+** ***************************************************************************
+*/
+
+/* ---------------------------------------------------------------------------
+** Each part of the key range runs on its own read connection and thread,
+** and buffers its rows as sqlite3_value copies. The calling thread delivers
+** the buffered rows, in part order for ORDERED, or as each part finishes for
+** COMBINE, so the callback never runs concurrently with itself.
+** ---------------------------------------------------------------------------
+*/
+typedef struct i_part
+{ struct i_parallel *par;
+  sqlite3_int64 lo, hi;         // this part of the key range, both inclusive
+  int ret;
+  int done;                     // set under the parallel mutex
+  int ncols;
+  int rows;
+  int cap;                      // rows allocated
+  sqlite3_value **vals;         // rows * ncols values
+  pthread_t thread;
+} i_part;
+
+typedef struct i_parallel
+{ int sqltype;
+  const void *sql;
+  const char *filename;
+  const i_bind_value *vals;
+  int nvals;
+  atomic_int abort;             // the caller stopped, or a part failed
+  pthread_mutex_t mx;
+  pthread_cond_t done;
+} i_parallel;
+
+/* ---------------------------------------------------------------------------
+** Free the buffered rows of a part.
+*/
+static void i_part_free_rows(i_part *pt)
+{ int i;
+  for (i=0;i<pt->rows*pt->ncols;i++) sqlite3_value_free(pt->vals[i]);
+  sqlite3_free(pt->vals);
+  pt->vals=NULL;
+  pt->rows=pt->cap=0;
+}
+
+/* ---------------------------------------------------------------------------
+** Worker thread, runs one part on its own connection.
+*/
+static void *i_part_run(void *arg)
+{ i_part *pt = (i_part*)arg;
+  i_parallel *par = pt->par;
+  sqlite3 *db=NULL;
+  sqlite3_stmt *stmt=NULL;
+  int i, ret;
+  
+  ret = sqlite3_open_v2(par->filename, &db, SQLITE_OPEN_READONLY|SQLITE_OPEN_NOMUTEX, NULL);
+  if (ret==SQLITE_OK)
+  { if (par->sqltype==1) ret=sqlite3_prepare_v2(db, (const char*)par->sql, -1, &stmt, NULL);
+    else ret=sqlite3_prepare16_v2(db, par->sql, -1, &stmt, NULL);
+    if ((ret==SQLITE_OK)&&(stmt==NULL)) ret=SQLITE_MISUSE;
+  }
+  
+  // the range bounds are ?1 and ?2, the stack params follow them.
+  if (ret==SQLITE_OK)
+  { int pcnt = sqlite3_bind_parameter_count(stmt);
+    if (pcnt<par->nvals+2) ret=SQLITE_ERR_BIND_STACK_MISSING_PARAMS;
+    else if (pcnt>par->nvals+2) ret=SQLITE_ERR_BIND_STACK_NOT_TERMINATED;
+    if (ret==SQLITE_OK) ret=sqlite3_bind_int64(stmt, 1, pt->lo);
+    if (ret==SQLITE_OK) ret=sqlite3_bind_int64(stmt, 2, pt->hi);
+    if (ret==SQLITE_OK) ret=i_bind_values(stmt, par->vals, 2, par->nvals);
+    pt->ncols = sqlite3_column_count(stmt);
+  }
+  
+  while (ret==SQLITE_OK)
+  { if (atomic_load(&par->abort)) { ret=SQLITE_ABORT; break; }
+    int r = sqlite3_step(stmt);
+    if (r==SQLITE_DONE) break;
+    if (r!=SQLITE_ROW) { ret=r; break; }
+    
+    if (pt->rows==pt->cap)
+    { int cap = (pt->cap==0) ? 64 : pt->cap*2;
+      sqlite3_value **v = (sqlite3_value**)sqlite3_realloc64(pt->vals, sizeof(sqlite3_value*) * (sqlite3_uint64)cap * (pt->ncols ? pt->ncols : 1));
+      if (v==NULL) { ret=SQLITE_NOMEM; break; }
+      pt->vals=v;
+      pt->cap=cap;
+    }
+    sqlite3_value **row = pt->vals + (pt->rows*pt->ncols);
+    for (i=0;i<pt->ncols;i++) 
+    { if ((row[i]=sqlite3_value_dup(sqlite3_column_value(stmt, i)))==NULL) ret=SQLITE_NOMEM;
+    }
+    if (ret!=SQLITE_OK) { for (i=0;i<pt->ncols;i++) sqlite3_value_free(row[i]); break; }
+    pt->rows++;
+  }
+  
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+  if ((ret!=SQLITE_OK)&&(ret!=SQLITE_ABORT)) atomic_store(&par->abort, 1);
+  
+  pthread_mutex_lock(&par->mx);
+  pt->ret=ret;
+  pt->done=1;
+  pthread_cond_broadcast(&par->done);
+  pthread_mutex_unlock(&par->mx);
+  return NULL;
+}
+
+static int i_bind_parallel_va(int sqltype, sqlite3 *db, const void *sql, int nconn, sqlite3_int64 lo, sqlite3_int64 hi, int mode, int (*callback)(void*,int,sqlite3_value**), void *arg, va_list params);
+
+/* ---------------------------------------------------------------------------
+** Public bind_parallel functions stage execution of i_bind_parallel_va
+** ---------------------------------------------------------------------------
+*/
+int sqlite3_bind_parallel(sqlite3 *db, const char *sql, int nconn, sqlite3_int64 lo, sqlite3_int64 hi, int mode, int (*callback)(void*,int,sqlite3_value**), void *arg, ...)
+{ va_list params;
+  va_start(params, arg);
+  int ret = i_bind_parallel_va(1, db, (const void*)sql, nconn, lo, hi, mode, callback, arg, params);
+  va_end(params);
+  return ret;
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_parallel16(sqlite3 *db, const void *sql, int nconn, sqlite3_int64 lo, sqlite3_int64 hi, int mode, int (*callback)(void*,int,sqlite3_value**), void *arg, ...)
+{ va_list params;
+  va_start(params, arg);
+  int ret = i_bind_parallel_va(2, db, sql, nconn, lo, hi, mode, callback, arg, params);
+  va_end(params);
+  return ret;
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_parallel_va(sqlite3 *db, const char *sql, int nconn, sqlite3_int64 lo, sqlite3_int64 hi, int mode, int (*callback)(void*,int,sqlite3_value**), void *arg, va_list params)
+{ return i_bind_parallel_va(1, db, (const void*)sql, nconn, lo, hi, mode, callback, arg, params);
+}
+/* --------------------------------------------------------------------------- */
+int sqlite3_bind_parallel_va16(sqlite3 *db, const void *sql, int nconn, sqlite3_int64 lo, sqlite3_int64 hi, int mode, int (*callback)(void*,int,sqlite3_value**), void *arg, va_list params)
+{ return i_bind_parallel_va(2, db, sql, nconn, lo, hi, mode, callback, arg, params);
+}
+
+/* ---------------------------------------------------------------------------
+** Bind Parallel implementation. 
+** ---------------------------------------------------------------------------
+*/
+static int i_bind_parallel_va(int sqltype, sqlite3 *db, const void *sql, int nconn, sqlite3_int64 lo, sqlite3_int64 hi, int mode, int (*callback)(void*,int,sqlite3_value**), void *arg, va_list params)
+{ g_last_err_code=SQLITE_OK;
+  int i, k, ret=SQLITE_OK, started=0, stop=0;
+  i_parallel par;
+  
+  if ((db==NULL)||(sql==NULL)||(nconn<=0)||(hi<lo)) return SQLITE_MISUSE;
+  if ((mode!=SQLITE_BIND_PARALLEL_ORDERED)&&(mode!=SQLITE_BIND_PARALLEL_COMBINE)) return SQLITE_MISUSE;
+  
+  // the parts need their own connections to the same file, so no memory or temp dbs.
+  const char *filename = sqlite3_db_filename(db, "main");
+  if ((filename==NULL)||(filename[0]==0)) return SQLITE_MISUSE;
+  
+  // split the span+1 keys of [lo,hi] into nconn parts, fewer if the range is smaller than that.
+  // each part gets count/nconn keys and the first count%nconn one more. span+1 overflows when
+  // the range is all of int64, so the split is worked out from span itself.
+  sqlite3_uint64 span = (sqlite3_uint64)hi - (sqlite3_uint64)lo;
+  if ((sqlite3_uint64)(nconn-1)>span) nconn=(int)span+1;
+  sqlite3_uint64 base = span/(sqlite3_uint64)nconn, rem = span%(sqlite3_uint64)nconn + 1;
+  if (rem==(sqlite3_uint64)nconn) { base++; rem=0; }
+  sqlite3_uint64 start = (sqlite3_uint64)lo;
+  
+  memset(&par, 0, sizeof(par));
+  par.sqltype=sqltype;
+  par.sql=sql;
+  par.filename=filename;
+  atomic_init(&par.abort, 0);
+  
+  va_list ap;
+  va_copy(ap, params);
+  ret = i_capture_params(&ap, (i_bind_value**)&par.vals, &par.nvals);
+  va_end(ap);
+  if (ret!=SQLITE_OK) return ret;
+  
+  i_part *parts = (i_part*)sqlite3_malloc(sizeof(i_part) * nconn);
+  if (parts==NULL) { sqlite3_free((void*)par.vals); return SQLITE_NOMEM; }
+  memset(parts, 0, sizeof(i_part) * nconn);
+  pthread_mutex_init(&par.mx, NULL);
+  pthread_cond_init(&par.done, NULL);
+  
+  for (i=0;i<nconn;i++)
+  { parts[i].par=&par;
+    parts[i].lo=(sqlite3_int64)start;
+    start += base + (((sqlite3_uint64)i<rem) ? 1 : 0);
+    parts[i].hi=(sqlite3_int64)(start - 1);
+    if (pthread_create(&parts[i].thread, NULL, i_part_run, parts+i)!=0) { ret=SQLITE_ERROR; break; }
+    started++;
+  }
+  if (ret!=SQLITE_OK) atomic_store(&par.abort, 1);
+  
+  // deliver each part once it is done, in part order or as they finish.
+  int *delivered = (int*)sqlite3_malloc(sizeof(int) * nconn);
+  if (delivered==NULL) { ret=SQLITE_NOMEM; atomic_store(&par.abort, 1); }
+  else memset(delivered, 0, sizeof(int) * nconn);
+  
+  for (k=0;((ret==SQLITE_OK)&&(k<started));k++)
+  { i_part *pt=NULL;
+    pthread_mutex_lock(&par.mx);
+    while (pt==NULL)
+    { if (mode==SQLITE_BIND_PARALLEL_ORDERED) { if (parts[k].done) pt=parts+k; }
+      else for (i=0;i<started;i++) if ((parts[i].done)&&(!delivered[i])) { pt=parts+i; break; }
+      if (pt==NULL) pthread_cond_wait(&par.done, &par.mx);
+    }
+    pthread_mutex_unlock(&par.mx);
+    delivered[pt-parts]=1;
+    
+    if ((ret=pt->ret)!=SQLITE_OK) break;
+    if (callback) for (i=0;((!stop)&&(i<pt->rows));i++)
+    { if (callback(arg, pt->ncols, pt->vals+(i*pt->ncols))!=0) stop=1;
+    }
+    i_part_free_rows(pt);
+    if (stop) { atomic_store(&par.abort, 1); break; }
+  }
+  
+  for (i=0;i<started;i++) 
+  { pthread_join(parts[i].thread, NULL);
+    i_part_free_rows(parts+i);
+  }
+  
+  // a part stopped by another part's failure reports SQLITE_ABORT, report the failure instead.
+  if (ret==SQLITE_ABORT) for (i=0;i<started;i++) if ((parts[i].ret!=SQLITE_OK)&&(parts[i].ret!=SQLITE_ABORT)) { ret=parts[i].ret; break; }
+  
+  pthread_cond_destroy(&par.done);
+  pthread_mutex_destroy(&par.mx);
+  sqlite3_free(delivered);
+  sqlite3_free(parts);
+  sqlite3_free((void*)par.vals);
+  if (ret<0) g_last_err_code=ret;
+  return ret;
+}
+
+#endif // I_SQLITE_BIND_OMIT_THREADS
+
+/* EOF */
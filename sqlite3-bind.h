@@ -29,6 +29,11 @@
 **   I_SQLITE_BIND_STACK_NOT_CHECKED prior to sqlite3-bind.h
 **   e.g. gcc -DI_SQLITE_BIND_STACK_NOT_CHECKED
 **
+** The write batch and parallel scan need pthreads and C11 atomics. You can
+** leave them out by defining I_SQLITE_BIND_OMIT_THREADS when building
+** sqlite3-bind.c
+**   e.g. gcc -DI_SQLITE_BIND_OMIT_THREADS
+**
 ** ---------------------------------------------------------------------------
 */
 
@@ -53,6 +58,8 @@ extern "C" {
 #define SQLITE_ERR_BIND_RESULT_COLUMNS_COUNT    (-4)   // the number of result columns does not match setup
 #define SQLITE_ERR_BIND_ARRAY_CANT_HAVE_RESULTS (-5)   // for now the bind_array functions cannot return results
                                                        // a query that generates results will create this error
+#define SQLITE_ERR_BIND_CANCELLED               (-6)   // the token was cancelled during execution
+#define SQLITE_ERR_BIND_DEADLINE                (-7)   // the token deadline passed during execution
 
 /* ---------------------------------------------------------------------------
 ** INTERNAL random guide bytes that provide some confidence that the stack 
@@ -85,6 +92,21 @@ const char *sqlite3_bind_errmsg(sqlite3 *db);
 #define SQLITE_BIND_ZBLOB(s)      I_SQLITE_BIND_TYPE_ZBLOB, (int)(s)
 #define SQLITE_BIND_END           ((unsigned int)0x87fa3dab)
 
+/* ---------------------------------------------------------------------------
+** A token bounds the execution of the _token variants of bind_exec and
+** bind_array. It carries an optional deadline (timeout_ms from creation, 0
+** for none) and can be cancelled from any thread. Either one stops the run
+** with SQLITE_ERR_BIND_CANCELLED or SQLITE_ERR_BIND_DEADLINE, and the rows
+** stepped (exec results, or array rows inserted) are kept in the token.
+** The token sets the progress handler of the db while it runs.
+*/
+typedef struct sqlite3_bind_token sqlite3_bind_token;
+
+int  sqlite3_bind_token_create (sqlite3_bind_token **token, int timeout_ms);
+void sqlite3_bind_token_cancel (sqlite3_bind_token *token);
+void sqlite3_bind_token_free   (sqlite3_bind_token *token);
+sqlite3_int64 sqlite3_bind_token_rows(sqlite3_bind_token *token);
+
 /* ---------------------------------------------------------------------------
 ** The sqlite_bind_exec functions follow the sqlite_exec API pattern
 ** but support variable arguments that will be bound to '?' markers
@@ -96,6 +118,11 @@ int sqlite3_bind_exec16    (sqlite3 *db, const void *sql, int (*callback)(void*,
 int sqlite3_bind_exec_va   (sqlite3 *db, const char *sql, int (*callback)(void*,int,char**,char**), void *arg, va_list params);
 int sqlite3_bind_exec_va16 (sqlite3 *db, const void *sql, int (*callback)(void*,int,char**,char**), void *arg, va_list params);
 
+int sqlite3_bind_exec_token      (sqlite3 *db, const char *sql, int (*callback)(void*,int,char**,char**), void *arg, sqlite3_bind_token *token, ...);
+int sqlite3_bind_exec_token16    (sqlite3 *db, const void *sql, int (*callback)(void*,int,char**,char**), void *arg, sqlite3_bind_token *token, ...);
+int sqlite3_bind_exec_token_va   (sqlite3 *db, const char *sql, int (*callback)(void*,int,char**,char**), void *arg, sqlite3_bind_token *token, va_list params);
+int sqlite3_bind_exec_token_va16 (sqlite3 *db, const void *sql, int (*callback)(void*,int,char**,char**), void *arg, sqlite3_bind_token *token, va_list params);
+
 /* ---------------------------------------------------------------------------
 ** The sqlite_bind_array functions are a convienence for inserting arrays
 ** of data in a single call using the argument binding features of sqlite.
@@ -121,6 +148,160 @@ int sqlite3_bind_array_va   (sqlite3 *db, const char *sql, int rows, va_list par
 int sqlite3_bind_array16    (sqlite3 *db, const void *sql, int rows, ...);
 int sqlite3_bind_array_va16 (sqlite3 *db, const void *sql, int rows, va_list params);
 
+int sqlite3_bind_array_token      (sqlite3 *db, const char *sql, int rows, sqlite3_bind_token *token, ...);
+int sqlite3_bind_array_token_va   (sqlite3 *db, const char *sql, int rows, sqlite3_bind_token *token, va_list params);
+int sqlite3_bind_array_token16    (sqlite3 *db, const void *sql, int rows, sqlite3_bind_token *token, ...);
+int sqlite3_bind_array_token_va16 (sqlite3 *db, const void *sql, int rows, sqlite3_bind_token *token, va_list params);
+
+/* ---------------------------------------------------------------------------
+** The sqlite_bind_array_pull functions are like bind_array, but the rows are
+** pulled from a producer callback in chunks instead of being passed in up front.
+** The library owns one set of column buffers of `capacity` rows, the producer
+** fills them and returns the number of rows filled (0 when done, negative to
+** abort), the chunk is bound and stepped, then the buffers are reused.
+** ---------------------------------------------------------------------------
+*/
+
+/* ---------------------------------------------------------------------------
+** User macros for pushing the column types on the stack for the pull functions
+*/
+#define SQLITE_BIND_COLUMN_BLOB          (I_SQLITE_BIND_TYPE_BLOB+3)
+#define SQLITE_BIND_COLUMN_DOUBLE        (I_SQLITE_BIND_TYPE_DOUBLE+3)
+#define SQLITE_BIND_COLUMN_INT           (I_SQLITE_BIND_TYPE_INT+3)
+#define SQLITE_BIND_COLUMN_INT64         (I_SQLITE_BIND_TYPE_INT64+3)
+#define SQLITE_BIND_COLUMN_TEXT          (I_SQLITE_BIND_TYPE_TEXT+3)
+#define SQLITE_BIND_COLUMN_TEXT16        (I_SQLITE_BIND_TYPE_TEXT16+3)
+#define SQLITE_BIND_COLUMN_NULL          (I_SQLITE_BIND_TYPE_NULL+3)
+#define SQLITE_BIND_COLUMN_ZBLOB(s)      (I_SQLITE_BIND_TYPE_ZBLOB+3), (int)(s)
+
+#define SQLITE_BIND_COLUMN_BLOCK_TEXT(s) (I_SQLITE_BIND_TYPE_TEXT+4), (int)(s)
+
+/* ---------------------------------------------------------------------------
+** One library owned column buffer handed to the producer, one per parameter.
+** data holds `capacity` entries of the column type: int, double, sqlite3_int64,
+** const char* (TEXT), const void* (TEXT16 and BLOB, with sizes), or a block of
+** `capacity * size` chars for BLOCK_TEXT. NULL and ZBLOB columns have no data.
+** Pointers stored in TEXT/BLOB columns must stay valid until the next fill.
+** The fields of the struct are read-only to the producer, it fills the
+** buffers they point to. They are set again before each fill.
+*/
+typedef struct sqlite3_bind_column
+{ unsigned int type;    // SQLITE_BIND_COLUMN_XXX marker the column was declared with
+  int size;             // width of each BLOCK_TEXT entry, or the size of each ZBLOB
+  int *sizes;           // BLOB only, the size of each entry
+  void *data;           // the column buffer
+} sqlite3_bind_column;
+
+int sqlite3_bind_array_pull      (sqlite3 *db, const char *sql, int capacity, int (*fill)(void*,int,sqlite3_bind_column*,int), void *arg, ...);
+int sqlite3_bind_array_pull_va   (sqlite3 *db, const char *sql, int capacity, int (*fill)(void*,int,sqlite3_bind_column*,int), void *arg, va_list params);
+int sqlite3_bind_array_pull16    (sqlite3 *db, const void *sql, int capacity, int (*fill)(void*,int,sqlite3_bind_column*,int), void *arg, ...);
+int sqlite3_bind_array_pull_va16 (sqlite3 *db, const void *sql, int capacity, int (*fill)(void*,int,sqlite3_bind_column*,int), void *arg, va_list params);
+
+/* ---------------------------------------------------------------------------
+** The sqlite_bind_cursor functions bind the stack to a query like bind_exec,
+** but the rows are fetched by the caller in batches with _next, which can be
+** called later, or interleaved with other work, until the query is done.
+** The params are bound without copies, so text/blob params must stay valid
+** until the cursor is closed, _reset keeps them bound. Each row is handed
+** to the callback as the statement itself, so the values are read with the
+** sqlite3_column_XXX functions without any copies.
+**
+** Closed cursors return their statement to a small cache, and a cursor opened
+** with the same sql on the same db reuses it. Call sqlite3_bind_cache_clear
+** before sqlite3_close to finalize the cached statements.
+** ---------------------------------------------------------------------------
+*/
+typedef struct sqlite3_bind_cursor sqlite3_bind_cursor;
+
+int sqlite3_bind_cursor_open      (sqlite3 *db, const char *sql, sqlite3_bind_cursor **cursor, ...);
+int sqlite3_bind_cursor_open16    (sqlite3 *db, const void *sql, sqlite3_bind_cursor **cursor, ...);
+int sqlite3_bind_cursor_open_va   (sqlite3 *db, const char *sql, sqlite3_bind_cursor **cursor, va_list params);
+int sqlite3_bind_cursor_open_va16 (sqlite3 *db, const void *sql, sqlite3_bind_cursor **cursor, va_list params);
+
+/* ---------------------------------------------------------------------------
+** Fetch up to `rows` rows, calling the callback for each. Returns SQLITE_ROW
+** if the query may have more rows, SQLITE_DONE once it is exhausted, or the
+** error that ended it, and later calls return the same code. The callback
+** gets the row's index within the batch, and a non-zero return from it ends
+** the batch early. fetched (if not NULL) receives the number of rows handed
+** to the callback.
+*/
+int sqlite3_bind_cursor_next  (sqlite3_bind_cursor *cursor, int rows, int (*callback)(void*,sqlite3_stmt*,int), void *arg, int *fetched);
+int sqlite3_bind_cursor_reset (sqlite3_bind_cursor *cursor);   // rewind to the first row, keeps the bound params
+int sqlite3_bind_cursor_close (sqlite3_bind_cursor *cursor);   // returns the statement to the cache
+
+int sqlite3_bind_cache_clear  (sqlite3 *db);                   // finalize cached statements for db (NULL for all)
+
+/* ---------------------------------------------------------------------------
+** The sqlite_bind_script functions prepare a multi-statement (;-separated)
+** script once, then run it many times with no parsing. _exec binds the 
+** stack across the statements in order, like bind_exec, and steps each one.
+** Rows are handed to the callback with the index of the statement they came
+** from. SQLITE_BIND_SCRIPT_TRANSACTION runs the script in one transaction
+** that is rolled back if any statement fails. All the statements are
+** prepared at compile time, so a statement can't use a table created by an
+** earlier statement of the same script.
+** ---------------------------------------------------------------------------
+*/
+#define SQLITE_BIND_SCRIPT_TRANSACTION  1
+
+typedef struct sqlite3_bind_script sqlite3_bind_script;
+
+int sqlite3_bind_script_compile   (sqlite3 *db, const char *sql, sqlite3_bind_script **script);
+int sqlite3_bind_script_compile16 (sqlite3 *db, const void *sql, sqlite3_bind_script **script);
+int sqlite3_bind_script_count     (sqlite3_bind_script *script);          // statements in the script
+int sqlite3_bind_script_params    (sqlite3_bind_script *script, int i);   // params of statement i, or all if i<0
+int sqlite3_bind_script_exec      (sqlite3_bind_script *script, int flags, int (*callback)(void*,sqlite3_stmt*,int), void *arg, ...);
+int sqlite3_bind_script_exec_va   (sqlite3_bind_script *script, int flags, int (*callback)(void*,sqlite3_stmt*,int), void *arg, va_list params);
+int sqlite3_bind_script_free      (sqlite3_bind_script *script);
+
+#ifndef I_SQLITE_BIND_OMIT_THREADS
+
+/* ---------------------------------------------------------------------------
+** The sqlite_bind_batch functions group the writes of many threads into
+** shared transactions (group commit). A single writer thread owns the db
+** while the batch is open and runs up to max_batch submitted statements per
+** transaction, waiting up to max_wait_ms for a batch to fill. Each _exec
+** blocks until its statement is committed and returns its own result, a
+** failed statement is rolled back alone, unless its error ends the whole
+** transaction (OR ROLLBACK, FULL, IOERR...), then the statements before it
+** in the batch return SQLITE_ABORT. The stack must end with
+** SQLITE_BIND_END, and text/blob params must stay valid until _exec returns.
+** Call _close only once no thread is still in _exec. _close finalizes the
+** cached statements of the db (see sqlite3_bind_cache_clear).
+** ---------------------------------------------------------------------------
+*/
+typedef struct sqlite3_bind_batch sqlite3_bind_batch;
+
+int sqlite3_bind_batch_open      (sqlite3 *db, int max_batch, int max_wait_ms, sqlite3_bind_batch **batch);
+int sqlite3_bind_batch_exec      (sqlite3_bind_batch *batch, const char *sql, ...);
+int sqlite3_bind_batch_exec16    (sqlite3_bind_batch *batch, const void *sql, ...);
+int sqlite3_bind_batch_exec_va   (sqlite3_bind_batch *batch, const char *sql, va_list params);
+int sqlite3_bind_batch_exec_va16 (sqlite3_bind_batch *batch, const void *sql, va_list params);
+int sqlite3_bind_batch_close     (sqlite3_bind_batch *batch);
+
+/* ---------------------------------------------------------------------------
+** The sqlite_bind_parallel functions split a query over the key range
+** [lo,hi] into nconn parts and run them at the same time, each on its own
+** read connection to the file of db (use WAL so readers don't block). The
+** sql must take each part's bounds as ?1 and ?2 (both inclusive), e.g.
+** "... where rowid between ?1 and ?2 and price<?", the stack binds ?3 on.
+** Each part's rows are buffered, then handed to the callback on the calling
+** thread, for ORDERED in part order (concatenation), for COMBINE in the order
+** the parts finish (partial aggregates to be combined by the callback).
+** The parts are separate read transactions, not one snapshot.
+** ---------------------------------------------------------------------------
+*/
+#define SQLITE_BIND_PARALLEL_ORDERED    1
+#define SQLITE_BIND_PARALLEL_COMBINE    2
+
+int sqlite3_bind_parallel      (sqlite3 *db, const char *sql, int nconn, sqlite3_int64 lo, sqlite3_int64 hi, int mode, int (*callback)(void*,int,sqlite3_value**), void *arg, ...);
+int sqlite3_bind_parallel16    (sqlite3 *db, const void *sql, int nconn, sqlite3_int64 lo, sqlite3_int64 hi, int mode, int (*callback)(void*,int,sqlite3_value**), void *arg, ...);
+int sqlite3_bind_parallel_va   (sqlite3 *db, const char *sql, int nconn, sqlite3_int64 lo, sqlite3_int64 hi, int mode, int (*callback)(void*,int,sqlite3_value**), void *arg, va_list params);
+int sqlite3_bind_parallel_va16 (sqlite3 *db, const void *sql, int nconn, sqlite3_int64 lo, sqlite3_int64 hi, int mode, int (*callback)(void*,int,sqlite3_value**), void *arg, va_list params);
+
+#endif // I_SQLITE_BIND_OMIT_THREADS
+
 #ifdef __cplusplus
 }
 #endif